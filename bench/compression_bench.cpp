@@ -0,0 +1,119 @@
+// COMPRESS=DEFLATE (RFC 4978) on a recorded session: bytes on the wire, CPU time of the deflate layer,
+// and the time the responses take on a slow link with and without compression.
+// The responses of a transcript (see IMAP_CAPTURE_FILE) are compressed record by record with a sync flush,
+// like a server does, and inflated again like the session does. Without a transcript a generated HTML token mail is used.
+//
+// Usage: bench_compression [transcript] [link kbit/s] [rounds]
+
+#include "compression.hpp"
+#include "transcript.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    // Verbose HTML mail with a token, like the ones the daemon fetches. The text is varied, repeated lines would compress unrealistically well.
+    std::string generated_response() {
+        static const char* words[] = {"account", "security", "never", "share", "this", "code", "with", "anyone", "support", "will", "ask",
+                                      "you", "for", "sign-in", "device", "location", "browser", "request", "expires", "minutes", "if",
+                                      "not", "contact", "us", "immediately", "protect", "your", "data", "privacy", "settings", "review"};
+        std::mt19937 rng(4711);
+        std::uniform_int_distribution<size_t> pick(0, std::size(words) - 1);
+        std::string html = "<html><head><style>td{font-family:Arial,sans-serif;color:#333333}</style></head><body><table width=\"100%\">";
+        for (int i = 0; i < 120; i++) {
+            html += "<tr><td style=\"padding:8px 24px;font-size:14px;line-height:20px\"><a href=\"https://example.com/t/" + std::to_string(rng()) + "\">";
+            for (int j = 0; j < 12; j++) {
+                html += std::string(j ? " " : "") + words[pick(rng)];
+            }
+            html += "</a></td></tr>\r\n";
+        }
+        html += "<tr><td style=\"font-size:28px;font-weight:bold\">Your code: 482913</td></tr></table></body></html>\r\n";
+        return "* 1 FETCH (UID 4711 BODY[1] {" + std::to_string(html.size()) + "}\r\n" + html + ")\r\nA7 OK FETCH completed\r\n";
+    }
+
+    // Server to client bytes of a transcript, one entry per record
+    std::vector<std::string> load_responses(const std::string& path) {
+        std::vector<std::string> responses;
+        TranscriptReader reader(path);
+        TranscriptRecord type;
+        uint64_t time;
+        std::string data;
+        while (reader.next(type, time, data)) {
+            if ((type == RECORD_HEADER || type == RECORD_DATA) && !data.empty()) {
+                responses.push_back(data);
+            }
+        }
+        return responses;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string path = argc > 1 ? argv[1] : "";
+    double link = argc > 2 ? std::strtod(argv[2], nullptr) : 1000; // kbit/s
+    int rounds = argc > 3 ? std::atoi(argv[3]) : 20;
+    if (link <= 0 || rounds <= 0) {
+        std::cerr << "Usage: bench_compression [transcript] [link kbit/s] [rounds]" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> responses;
+    try {
+        responses = path.empty() ? std::vector<std::string>{generated_response()} : load_responses(path);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (responses.empty()) {
+        std::cerr << "The transcript holds no responses." << std::endl;
+        return 1;
+    }
+
+    size_t plain = 0;
+    size_t wire = 0;
+    double deflate_seconds = 0;
+    double inflate_seconds = 0;
+    for (int round = 0; round < rounds; round++) {
+        compression::Deflater deflater; // One stream per session, the dictionary carries over between responses
+        compression::Inflater inflater;
+        std::string compressed;
+        std::string restored;
+        for (const std::string& response : responses) {
+            compressed.clear();
+            auto start = clock::now();
+            deflater.compress(response.data(), response.size(), compressed);
+            auto middle = clock::now();
+            restored.clear();
+            inflater.decompress(compressed.data(), compressed.size(), restored);
+            auto end = clock::now();
+
+            if (restored != response) {
+                std::cerr << "Round trip mismatch." << std::endl;
+                return 1;
+            }
+            deflate_seconds += std::chrono::duration<double>(middle - start).count();
+            inflate_seconds += std::chrono::duration<double>(end - middle).count();
+            if (round == 0) {
+                plain += response.size();
+                wire += compressed.size();
+            }
+        }
+    }
+
+    // Transfer time of the responses on the link, the client pays the inflate time on top
+    double bytes_per_second = link * 1000 / 8;
+    double inflate = inflate_seconds / rounds;
+    std::printf("%s: %zu responses, %zu bytes\n", path.empty() ? "generated token mail" : path.c_str(), responses.size(), plain);
+    std::printf("wire: %zu bytes compressed, ratio %.2f\n", wire, static_cast<double>(plain) / wire);
+    std::printf("cpu: deflate %.1f MB/s (server side), inflate %.1f MB/s\n", plain * rounds / deflate_seconds / 1e6, plain * rounds / inflate_seconds / 1e6);
+    std::printf("at %.0f kbit/s: %.1f ms uncompressed, %.1f ms compressed (%.3f ms of it inflating)\n",
+                link, plain / bytes_per_second * 1000, (wire / bytes_per_second + inflate) * 1000, inflate * 1000);
+    return 0;
+}
\ No newline at end of file
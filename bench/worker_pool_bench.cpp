@@ -0,0 +1,147 @@
+// Capacity of the worker pool: CPU, memory and detection latency per 1,000 mailboxes.
+// The mailboxes are simulated, a step blocks for one round trip like a poll of a real session,
+// so the numbers cover the pool and the scheduling, not libcurl or TLS.
+//
+// Usage: bench_worker_pool [mailboxes] [threads] [seconds] [round trip ms] [poll interval ms]
+
+#include "worker_pool.hpp"
+#include "os.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    std::mutex samples_mutex;
+    std::vector<long> detections; // Milliseconds from the arrival of a token to the poll that found it
+    std::vector<long> arm_delays; // Milliseconds from os::wake_all() to the woken poll
+    std::atomic<long> wake_time{0}; // Time of the last wake in milliseconds since start, 0 if none
+    const clock::time_point start = clock::now();
+
+    long since_start() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count();
+    }
+
+    // Peak resident memory in KiB, 0 where it is not available
+    long peak_memory() {
+#ifndef _WIN32
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+#else
+        return 0;
+#endif
+    }
+
+    long percentile(std::vector<long>& values, int p) {
+        if (values.empty()) {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1, values.size() * p / 100)];
+    }
+
+    // Mailbox that receives a token now and then, found by the next poll
+    class SimulatedMailbox : public WorkerPool::Job {
+    private:
+        long round_trip;
+        long interval;
+
+    public:
+        std::atomic<long> arrival{-1}; // Arrival of the pending token in milliseconds since start, -1 if none
+
+        SimulatedMailbox(long round_trip, long interval) : round_trip(round_trip), interval(interval) {}
+
+        long step(bool woken) override {
+            long polled = since_start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(round_trip)); // The poll blocks like a SEARCH
+            long token = arrival.exchange(-1);
+
+            std::lock_guard<std::mutex> lock(samples_mutex);
+            if (token >= 0 && token <= polled) {
+                detections.push_back(since_start() - token);
+            } else if (token >= 0) {
+                arrival = token; // Arrived during the poll, the next one finds it
+            }
+            if (woken && wake_time > 0) {
+                arm_delays.push_back(since_start() - wake_time);
+            }
+            return interval;
+        }
+    };
+}
+
+int main(int argc, char** argv) {
+    size_t mailboxes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    size_t threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 0;
+    long seconds = argc > 3 ? std::strtol(argv[3], nullptr, 10) : 10;
+    long round_trip = argc > 4 ? std::strtol(argv[4], nullptr, 10) : 20;
+    long interval = argc > 5 ? std::strtol(argv[5], nullptr, 10) : 1000;
+    if (mailboxes == 0 || seconds <= 0) {
+        std::cerr << "Usage: bench_worker_pool [mailboxes] [threads] [seconds] [round trip ms] [poll interval ms]" << std::endl;
+        return 1;
+    }
+    if (!os::init()) {
+        return 1;
+    }
+
+    long memory_before = peak_memory();
+    WorkerPool pool(threads);
+    std::vector<SimulatedMailbox*> jobs;
+    for (size_t i = 0; i < mailboxes; i++) {
+        auto job = std::make_unique<SimulatedMailbox>(round_trip, interval);
+        jobs.push_back(job.get());
+        pool.add(std::move(job));
+    }
+
+    // Tokens arrive at random mailboxes every 10 ms, the daemon is armed every second
+    std::thread load([&]() {
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<size_t> pick(0, mailboxes - 1);
+        auto end = clock::now() + std::chrono::seconds(seconds);
+        auto next_arm = clock::now() + std::chrono::seconds(1);
+        while (clock::now() < end) {
+            long expected = -1;
+            jobs[pick(rng)]->arrival.compare_exchange_strong(expected, since_start());
+            if (clock::now() >= next_arm) {
+                wake_time = since_start();
+                os::wake_all();
+                next_arm += std::chrono::seconds(1);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        os::request_shutdown();
+    });
+
+    std::clock_t cpu_start = std::clock(); // Processor time of the process (wall time on Windows)
+    auto wall_start = clock::now();
+    pool.run();
+    double cpu = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+    double wall = std::chrono::duration<double>(clock::now() - wall_start).count();
+    load.join();
+
+    double per_thousand = 1000.0 / mailboxes;
+    size_t workers = std::min(mailboxes, threads > 0 ? threads : std::max<size_t>(1, std::thread::hardware_concurrency()));
+    std::printf("%zu mailboxes on %zu threads, %ld ms round trip, %ld ms interval, %.1f s\n", mailboxes, workers, round_trip, interval, wall);
+    std::printf("cpu: %.3f cores per 1,000 mailboxes\n", cpu / wall * per_thousand);
+    if (memory_before > 0) {
+        std::printf("memory: %.0f KiB per 1,000 mailboxes (peak resident growth)\n", (peak_memory() - memory_before) * per_thousand);
+    }
+    std::printf("detection: %zu tokens, p50 %ld ms, p99 %ld ms\n", detections.size(), percentile(detections, 50), percentile(detections, 99));
+    std::printf("arm: %zu woken polls, p50 %ld ms, p99 %ld ms\n", arm_delays.size(), percentile(arm_delays, 50), percentile(arm_delays, 99));
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "defines.h"
+
+// Heap allocation accounting per pipeline stage (enabled with ALLOC_PROFILING in defines.h).
+// When enabled, the global operator new/delete are replaced with counting hooks.
+namespace alloc_profiler {
+    // Pipeline stage an allocation is attributed to
+    enum Stage {
+        STAGE_OTHER,
+        STAGE_SEARCH,
+        STAGE_FETCH,
+        STAGE_DECODE,
+        STAGE_EXTRACT,
+        STAGE_LOG,
+        STAGE_COUNT
+    };
+
+#if ALLOC_PROFILING
+    // Attributes all allocations of the current thread to a stage while in scope
+    class ScopedStage {
+    private:
+        Stage previous; // Stage to restore when leaving the scope
+
+    public:
+        explicit ScopedStage(Stage stage);
+        ~ScopedStage();
+
+        ScopedStage(const ScopedStage&) = delete; // Prevent copying
+        ScopedStage& operator=(const ScopedStage&) = delete; // Prevent assignment
+    };
+#else
+    // No-op when profiling is disabled
+    class ScopedStage {
+    public:
+        explicit ScopedStage(Stage) {}
+    };
+#endif
+
+    void end_cycle(); // Marks the end of a poll cycle for the per-cycle statistics
+    void report(); // Logs allocations, bytes and peak usage per stage
+} // namespace alloc_profiler
\ No newline at end of file
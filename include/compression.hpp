@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <zlib.h>
+
+namespace compression {
+    // Streaming raw DEFLATE compressor (RFC 1951 without zlib header, as required by RFC 4978)
+    class Deflater {
+    private:
+        z_stream stream; // zlib stream state
+
+    public:
+        Deflater(int level = Z_DEFAULT_COMPRESSION);
+        ~Deflater();
+
+        Deflater(const Deflater&) = delete; // Prevent copying
+        Deflater& operator=(const Deflater&) = delete; // Prevent assignment
+
+        // Compresses the data and appends it to out, flushed so the peer can decode it immediately
+        void compress(const char* data, size_t length, std::string& out);
+    };
+
+    // Streaming raw DEFLATE decompressor
+    class Inflater {
+    private:
+        z_stream stream; // zlib stream state
+
+    public:
+        Inflater();
+        ~Inflater();
+
+        Inflater(const Inflater&) = delete; // Prevent copying
+        Inflater& operator=(const Inflater&) = delete; // Prevent assignment
+
+        // Decompresses the data and appends the result to out
+        void decompress(const char* data, size_t length, std::string& out);
+    };
+} // namespace compression
\ No newline at end of file
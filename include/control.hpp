@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+class TokenHistory; // Token history, see history.hpp
+
+// Local control of the running daemon, e.g. arming it right after "Send code" was clicked
+namespace control {
+    // Arms the daemon for a sender ("user@domain", "*@domain", empty for any) for the given time.
+    // While armed the watchers poll every ARM_POLLING_INTERVAL milliseconds, the first token of the sender disarms.
+    void arm(const std::string& sender, std::chrono::seconds window);
+    void disarm();
+    bool armed(); // False once the window has passed
+    void on_token(const std::string& sender); // Disarms if the token is the one the daemon was armed for
+
+    // Answers a request line: "arm [sender] [seconds]", "disarm", "status", "last <sender>", "recent [seconds]" or "profile [start|stop]"
+    std::string handle(const std::string& request, const TokenHistory* history);
+
+    // Sends the arguments as a request to the running daemon and prints the answer, returns the exit code
+    int run_client(const std::vector<std::string>& args);
+}
\ No newline at end of file
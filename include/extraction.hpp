@@ -0,0 +1,51 @@
+#pragma once
+
+#include "html_text.hpp"
+
+#include <string>
+#include <string_view>
+#include <regex>
+#include <optional>
+
+// Describes how the token is found in the decoded body of a sender's emails
+struct ExtractionProfile {
+    using Matcher = std::optional<std::string_view> (*)(std::string_view text, bool& marker_seen); // Returns the token in the run, the flag carries the marker to later runs
+
+    std::string name; // Name used by the sender rules
+    std::regex pattern; // Regex with the token as first capture group
+    bool markup; // The pattern contains tags and is matched against the raw body
+    Matcher matcher = nullptr; // Specialized matcher of a compiled-in profile, used instead of the pattern
+
+    // Constructors
+    ExtractionProfile(const std::string& name, const std::string& pattern)
+        : name(name), pattern(pattern), markup(pattern.find('<') != std::string::npos) {}
+    ExtractionProfile(const std::string& name, Matcher matcher) // See static_profile.hpp
+        : name(name), markup(false), matcher(matcher) {}
+};
+
+// Searches the decoded body for a token using the given profile.
+// The pattern is matched against the normalized text, preferring bold or large text near the word "code".
+// While the body is incomplete, only matches with such hints are accepted.
+// Patterns written for the markup are matched against the raw body.
+std::optional<std::string> extract_token(const ExtractionProfile& profile, const std::string& body, bool html = true, bool complete = true);
+
+// Incremental extract_token for a body that arrives in chunks, keeps only the text that was not matched yet.
+// A hinted match (or any match of a markup pattern) confirms the token, so the rest of the body can be skipped.
+class TokenScanner {
+public:
+    TokenScanner(const ExtractionProfile& profile, bool html = true);
+    bool feed(std::string_view text); // Scans the next decoded chunk, true once the token is confirmed
+    std::optional<std::string> finish(); // Call after the last chunk, returns the best match of the whole body
+    std::optional<std::string> confirmed() const; // The token if it is already certain
+
+private:
+    const ExtractionProfile& profile;
+    html::Normalizer normalizer;
+    std::string raw; // Unscanned rest of the body and the end of the scanned part, only kept for markup patterns
+    std::optional<std::string> best; // Best match so far
+    int best_score = -1; // Number of hints of the best match
+    bool marker_seen = false; // A run so far contained the marker of the specialized matcher
+
+    void scan_runs(); // Matches the runs the normalizer finished since the last call
+    bool scan_raw(size_t end); // Matches the markup pattern in raw[0, end)
+};
\ No newline at end of file
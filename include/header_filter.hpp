@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <ctime>
+
+// Header fields of an email, fetched for all candidates in one request before any body
+struct MessageHeaders {
+    std::string from; // From header as received
+    std::string subject; // Subject with encoded words decoded
+    std::string content_type; // Media type in lowercase, without parameters
+    std::time_t received = 0; // INTERNALDATE, 0 if the server did not send it
+
+    // Builds the headers from the HEADER.FIELDS literal and the INTERNALDATE of a FETCH response
+    static MessageHeaders parse(const std::string& fields, const std::string& internaldate);
+};
+
+// Local rules deciding from the headers alone whether an email can hold a token, so bodies are only fetched when needed.
+// Subject patterns are case-insensitive substrings.
+class HeaderFilter {
+private:
+    std::vector<std::string> required; // The subject must contain one of these, if any are given
+    std::vector<std::string> ignored; // The subject must contain none of these
+    long max_age; // Seconds an email may be old at most
+
+public:
+    // Constructor
+    HeaderFilter(const std::vector<std::string>& required, const std::vector<std::string>& ignored, long max_age);
+
+    // Returns why the email cannot hold a token, nullopt if its body should be fetched
+    std::optional<std::string> reject(const MessageHeaders& headers, std::time_t now) const;
+};
+
+// Parses an IMAP date-time ("17-Jul-1996 02:44:25 -0700") to UTC, 0 if it is malformed
+std::time_t parse_internaldate(const std::string& date);
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "os.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+
+// Delivered token as stored in the history
+struct HistoryEntry {
+    std::string sender; // Address of the sender
+    std::string mailbox; // Mailbox the email arrived in
+    std::string token;
+    std::time_t received = 0; // Arrival time of the email (INTERNALDATE)
+    std::time_t delivered = 0; // Time the token was copied to the clipboard, 0 if that failed
+};
+
+// Append-only file of delivered tokens, memory-mapped with fixed-size records.
+// Appends only copy into the mapping, a background thread groups them into one fsync.
+// Senders and arrival times are indexed in memory, rebuilt from the file when it is opened.
+class TokenHistory {
+private:
+    // Layout of a record in the file, strings are truncated and NUL padded
+    struct Record {
+        int64_t received;
+        int64_t delivered;
+        char sender[96];
+        char mailbox[32];
+        char token[64];
+    };
+    static_assert(sizeof(Record) == 208, "The record layout is part of the file format");
+
+    os::MappedFile file;
+    uint64_t count = 0; // Records in the file
+    std::multimap<std::pair<std::string, int64_t>, uint64_t> by_sender; // (sender, received) to record number
+    std::multimap<int64_t, uint64_t> by_time; // received to record number
+    mutable std::mutex history_mutex; // Guards the fields above and the mapping
+
+    std::mutex resize_mutex; // Held while syncing or growing the file, so the mapping stays put during a sync
+    std::mutex sync_mutex; // Guards dirty and stopping, never held during a sync
+    std::condition_variable sync_cv;
+    std::chrono::milliseconds sync_delay; // Appends within this time share one fsync
+    bool dirty = false; // Appended since the last sync
+    bool stopping = false;
+    std::thread syncer;
+
+    Record* record(uint64_t number) const;
+    HistoryEntry entry(uint64_t number) const;
+    void sync_loop();
+
+public:
+    // Opens or creates the history file, throws if it cannot be used
+    TokenHistory(const std::string& path, std::chrono::milliseconds sync_delay);
+    ~TokenHistory(); // Syncs the pending appends
+
+    void append(const HistoryEntry& entry);
+    std::optional<HistoryEntry> last(const std::string& sender) const; // Latest token of the sender (by arrival)
+    std::vector<HistoryEntry> between(std::time_t from, std::time_t to) const; // Tokens that arrived in [from, to]
+    uint64_t size() const;
+};
\ No newline at end of file
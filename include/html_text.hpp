@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+namespace html {
+    // Presentation hints of a text run, combined as bit flags
+    enum TextHint : unsigned {
+        HINT_NONE = 0,
+        HINT_BOLD = 1 << 0, // Inside <b>, <strong>, a heading or a bold font-weight
+        HINT_LARGE = 1 << 1, // Inside <h1>-<h3>, <big> or a large font-size
+        HINT_NEAR_CODE = 1 << 2 // Contains or closely follows the word "code"
+    };
+
+    // Text between two tags that change the layout or the hints
+    struct TextRun {
+        std::string text; // Whitespace collapsed, entities decoded
+        unsigned hints = HINT_NONE; // TextHint flags
+    };
+
+    // Single-pass HTML to text converter. Input can be fed in chunks of any size,
+    // tags, entities and comments split between chunks are completed by the next one.
+    // <style> and <script> blocks are dropped.
+    class Normalizer {
+    public:
+        explicit Normalizer(bool markup = true); // Without markup only whitespace is collapsed and every line is a run
+        void feed(std::string_view data); // Processes the next chunk
+        void finish(); // Ends the last run, call after the last chunk
+        const std::vector<TextRun>& runs() const & { return output; }
+        std::vector<TextRun> runs() && { return std::move(output); }
+        std::vector<TextRun> take_runs() { return std::exchange(output, {}); } // Hands over the finished runs, keeps the state
+
+    private:
+        enum State { TEXT, TAG, COMMENT, ENTITY };
+
+        bool markup;
+        State state = TEXT;
+        std::string tag; // Tag being read, without the angle brackets
+        std::string lowered; // Lowercased copy of the tag, reused to avoid allocations
+        char quote = 0; // Open quote inside the tag
+        unsigned dashes = 0; // Dashes in a row inside a comment
+        std::string entity; // Entity being read, without '&' and ';'
+        std::string skip; // Element whose content is dropped (style or script)
+        std::vector<std::pair<std::string, unsigned>> stack; // Open elements and their hints
+        TextRun current; // Run being built
+        bool pending_space = false; // Whitespace seen since the last character
+        size_t since_code; // Characters emitted since the last "code"
+        std::vector<TextRun> output;
+
+        unsigned hints() const { return stack.empty() ? HINT_NONE : stack.back().second; }
+        void append(char c);
+        void append(const char* begin, const char* end);
+        void end_run();
+        void handle_tag();
+        void handle_entity(bool terminated);
+    };
+
+    std::vector<TextRun> normalize(std::string_view data, bool markup = true); // Normalizes a complete document
+} // namespace html
\ No newline at end of file
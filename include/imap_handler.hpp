@@ -2,8 +2,16 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <string_view>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <ctime> // For std::tm
 #include "curl/curl.h"
+#include "uid_set.hpp"
 
 class Response {
 public:
@@ -15,6 +23,53 @@ public:
     Response(CURLcode code = CURLE_OK, const std::string& header = "", const std::string& data = "") : code(code), header(header), data(data) {}
 };
 
+// Header fields and arrival time of one email, see IMAPHandler::fetch_header_fields()
+struct HeaderFields {
+    std::string fields; // Requested header fields as sent by the server
+    std::string internaldate; // INTERNALDATE without quotes
+};
+
+// Receives the literal data of a response while it arrives, returns false once it has seen enough
+using LiteralConsumer = std::function<bool(std::string_view)>;
+
+// Fast path chosen for each operation from the server capabilities, the comment names the fallback
+struct FastPaths {
+    bool esearch = false; // Search with RETURN (MIN MAX ALL) (ESEARCH, RFC 4731), else one UID per email
+    bool uid_expunge = false; // Expunge only our UIDs with UID EXPUNGE (UIDPLUS, RFC 4315), else EXPUNGE every \Deleted email
+    bool compress = false; // COMPRESS=DEFLATE (RFC 4978) if enabled, else uncompressed
+    bool notify = false; // Watch all mailboxes on one connection (NOTIFY, RFC 5465), else one connection per mailbox
+
+    std::string describe() const; // Active paths and fallbacks for the log
+};
+
+// Longest time in milliseconds each kind of operation may take from its first command to its completion
+struct Deadlines {
+    long connect = 15000; // TCP, TLS, login and capabilities
+    long search = 10000; // UID SEARCH
+    long fetch = 20000; // Every UID FETCH
+    long store = 10000; // STORE and EXPUNGE
+    long command = 10000; // Everything else (SELECT, NOOP, ...)
+};
+
+// Lets other threads abort the IMAP operations of a handler, e.g. on shutdown or reload.
+// Aborted operations throw, the handler has to reconnect afterwards.
+class CancelToken {
+private:
+    std::atomic<uint64_t> generation{0}; // Incremented by every cancel()
+    std::atomic<bool> closed{false};
+
+public:
+    void cancel() { generation.fetch_add(1); } // Abort the operations running now
+    void close() { closed = true; cancel(); } // Abort the running and all later operations
+    uint64_t current() const { return generation.load(); }
+    bool cancelled_since(uint64_t start) const { return closed.load() || generation.load() != start; }
+};
+
+class IMAPStream; // Raw command channel, see imap_stream.hpp
+class LiteralTap; // Literal splitter for the libcurl callbacks, see imap_stream.hpp
+class TranscriptWriter; // Session capture, see transcript.hpp
+class TranscriptReader; // Session replay, see transcript.hpp
+
 // IMAP handler
 class IMAPHandler {
 private:
@@ -26,9 +81,25 @@ private:
     const std::string password; // Password for the IMAP server
 
     // Connection settings
-    long timeout; // Timeout for the connection
+    long timeout; // Milliseconds without any data from the server before a response is given up
     bool use_ssl; // Use SSL for the connection
     bool verbose; // Verbose output for debugging
+    bool use_compression = false; // Negotiate COMPRESS=DEFLATE (RFC 4978) after login
+    bool use_native = false; // Send commands over the raw connection instead of CURLOPT_CUSTOMREQUEST
+
+    // Raw command channel, used instead of CURLOPT_CUSTOMREQUEST by the native backend and for compression
+    std::unique_ptr<IMAPStream> stream;
+    Response receive_stream(const std::string& cmd, const std::string& tag); // Complete a command sent on the stream
+    UidSet pending_deletes; // UIDs queued by queue_delete()
+    static std::vector<std::string> delete_commands(const UidSet& uids, bool uid_expunge); // STORE and EXPUNGE for the UIDs
+    static UidSet parse_search(const std::string& data); // UIDs of a SEARCH or ESEARCH response
+
+    // Record and replay
+    std::string capture_path; // Transcript file written while connected, empty to disable
+    std::string replay_path; // Transcript file replayed instead of connecting, empty to disable
+    std::unique_ptr<TranscriptWriter> capture; // Open capture transcript
+    std::unique_ptr<TranscriptReader> replay; // Open replay transcript
+    Response replay_response(const std::string& cmd); // Feed the next recorded response through the callbacks
 
     // Callback functions
     static size_t write_callback(char* ptr, size_t size, size_t nmemb, void* handler); // Callback for writing data
@@ -37,11 +108,44 @@ private:
     // Buffers
     std::string userdata; // Buffer for received data
     std::string headerdata; // Buffer for received header data
+    LiteralTap* tap = nullptr; // Takes the literals out of headerdata while a streaming fetch runs
     Response last_response; // Last response from the server
+    std::string uidvalidity; // UIDVALIDITY of the selected mailbox
+
+    // Capabilities
+    std::vector<std::string> capabilities; // Announced after login, cached per server
+    FastPaths paths; // Chosen from the capabilities on connect
+    void negotiate(); // Discover the capabilities and choose the fast paths
+
+    // Deadlines and cancellation
+    Deadlines deadlines;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(); // Of the running operation
+    std::shared_ptr<CancelToken> cancel_token; // Shared with the threads that may cancel, may be null
+    uint64_t cancel_generation = 0; // Token generation when the running operation started
+    bool cancelled() const;
+    void apply_deadline(); // Hand the remaining time to libcurl or the stream, throws if it is used up
+    static int progress_callback(void* handler, curl_off_t, curl_off_t, curl_off_t, curl_off_t); // Aborts cancelled transfers
+
+    // Sets the deadline of an operation for its lifetime. Nested scopes keep the outer deadline,
+    // so a fetch made of several commands gets one deadline for all of them.
+    class DeadlineScope {
+    private:
+        IMAPHandler& handler;
+        bool outermost;
+
+    public:
+        DeadlineScope(IMAPHandler& handler, long milliseconds);
+        ~DeadlineScope();
+    };
+
+    // Liveness
+    double srtt = 0; // Smoothed round-trip time of probes in milliseconds (RFC 6298), 0 before the first probe
+    double rttvar = 0; // Variation of the round-trip time in milliseconds
+    bool unresponsive = false; // The last probe failed, the LOGOUT on disconnect gets a short timeout
 
 public:
     // Constructor
-    IMAPHandler(const std::string& server, const std::string& port, const std::string& username, const std::string& password, long timeout=36000L, bool verbose = false);
+    IMAPHandler(const std::string& server, const std::string& port, const std::string& username, const std::string& password, long timeout=5000L, bool verbose = false);
 
     // Destructor
     ~IMAPHandler();
@@ -52,28 +156,51 @@ public:
     void disconnect();
 
     // Request functions
+    std::vector<std::string> capability();
     Response select(std::string mailbox);
     Response raw_search(std::string criteria);
-    std::vector<std::string> search(std::string criteria);
-    std::vector<std::string> search_from(std::string from);
+    UidSet search(std::string criteria); // Uses ESEARCH if available, so the result stays range-encoded on the wire
+    UidSet search_from(std::string from);
 
     Response raw_fetch(std::string uid, std::string data);
     Response fetch_internaldate(std::string uid);
     Response fetch_body(std::string uid, int part = -1);
+    Response fetch_bodystructure(std::string uid);
+    // Pass the first limit bytes of a body part to the consumer while they arrive, the rest is skipped once it returns false.
+    // The literal is not part of the returned response.
+    Response fetch_body_streaming(std::string uid, const std::string& section, size_t limit, const LiteralConsumer& consumer);
+    std::map<uint32_t, HeaderFields> fetch_header_fields(const UidSet& uids, const std::string& fields); // Includes the INTERNALDATE
 
-    Response delete_uids(std::vector<std::string> uids);
+    Response delete_uids(const UidSet& uids);
+    void queue_delete(const UidSet& uids); // Delete in the same round trip as the next request
 
     // Perform a request to the IMAP server
     Response perform_custom_request(const std::string cmd);
+    // Send all commands before waiting for the first completion (one round trip with the native backend)
+    std::vector<Response> perform_pipelined(const std::vector<std::string>& cmds);
+    // Send a NOOP that must complete within srtt + 4 * rttvar (at least min_timeout ms), false if it is late or fails
+    bool probe(long min_timeout);
 
     // Setter and getter functions
     void set_verbose(bool verbose);
     void set_debug(bool debug);
+    void set_compression(bool compression);
+    void set_native(bool native);
+    void set_capture(const std::string& path);
+    void set_replay(const std::string& path);
+    void set_deadlines(const Deadlines& deadlines);
+    void set_cancel_token(std::shared_ptr<CancelToken> token);
     std::string get_username() const;
     std::string get_password() const;
     bool get_use_ssl() const;
     bool get_verbose() const;
     bool get_debug() const;
+    bool get_compression() const;
+    bool get_native() const;
     std::string get_server() const;
     std::string get_port() const;
+    std::string get_uidvalidity() const;
+    bool supports(const std::string& capability) const; // Announced by the server after login
+    const FastPaths& get_fast_paths() const;
+    double get_rtt() const;
 };
\ No newline at end of file
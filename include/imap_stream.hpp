@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <deque>
+#include <map>
+#include <set>
+#include <string_view>
+#include <utility>
+#include <chrono>
+#include <functional>
+#include "curl/curl.h"
+#include "imap_handler.hpp"
+#include "compression.hpp"
+
+// Raw IMAP command channel on top of a logged-in CURL connection (CURLOPT_CONNECT_ONLY).
+// Used whenever the session needs something libcurl cannot do itself, like COMPRESS=DEFLATE
+// or several tagged commands in flight at once (pipelining).
+class IMAPStream {
+private:
+    CURL* curl; // Connected CURL handle, owned by the IMAPHandler
+    long timeout; // Milliseconds without any data from the server before giving up
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(); // Of the running operation
+    std::function<bool()> interrupted; // Checked while waiting, true aborts the wait
+    unsigned int tag_counter = 0; // Counter for command tags
+
+    // Pipelining
+    std::deque<std::string> in_flight; // Tags sent but not completed, oldest first
+    std::map<std::string, std::pair<Response, std::string>> completed; // Completed but not received responses and their error
+    Response current; // Response of the oldest command in flight
+    std::set<std::string> abandoned; // Tags whose remaining response is dropped after an early stop
+
+    // Streaming
+    size_t literal_left = 0; // Remaining bytes of the literal being read
+    const LiteralConsumer* consumer = nullptr; // Receives the literals of consumer_tag instead of the header
+    std::string consumer_tag; // Command whose literals are streamed
+    bool consumer_stopped = false; // The consumer returned false
+
+    // Compression layer (RFC 4978), active after COMPRESS DEFLATE succeeded
+    std::unique_ptr<compression::Deflater> deflater;
+    std::unique_ptr<compression::Inflater> inflater;
+
+    // Buffers
+    std::string inbuf; // Decompressed data received from the server
+    size_t inpos = 0; // Read position in inbuf
+    std::string outbuf; // Data waiting to be sent to the server
+
+    void wait_socket(bool for_recv); // Wait until the socket is readable or writable
+    void send_all(const std::string& data); // Send data through the compression layer
+    void fill(); // Receive more data into inbuf
+    void read_completion(); // Read responses up to the next tagged completion
+
+public:
+    // Constructor
+    IMAPStream(CURL* curl, long timeout);
+
+    // Send a command without waiting for its completion, returns its tag
+    std::string send(const std::string& cmd);
+
+    // Read responses until the command with the given tag completed, throws if it failed
+    Response receive(const std::string& tag);
+
+    // Like receive(), but literal data goes to the consumer. Returns the response read so far as soon
+    // as the consumer returns false, the rest of it is dropped while waiting for the next command.
+    Response receive_streaming(const std::string& tag, const LiteralConsumer& consumer);
+
+    // Switch on the compression layer after the server accepted COMPRESS DEFLATE
+    void enable_compression();
+
+    // Setter functions
+    void set_deadline(std::chrono::steady_clock::time_point deadline);
+    void set_interrupt(std::function<bool()> interrupted);
+};
+
+// Splits the response bytes libcurl passes to the header callback into lines and literal data.
+// Literal data goes to the consumer until it returns false and is skipped after that, so the
+// transfer still runs to its end (aborting it would drop the connection) but nothing is kept.
+class LiteralTap {
+private:
+    const LiteralConsumer& consumer;
+    std::string line; // Incomplete response line
+    size_t literal_left = 0; // Remaining bytes of the literal being read
+    bool stopped = false; // The consumer returned false
+
+public:
+    explicit LiteralTap(const LiteralConsumer& consumer);
+
+    // Pass the next chunk, the response lines are appended to lines
+    void feed(std::string_view data, std::string& lines);
+};
\ No newline at end of file
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+namespace metrics {
+    // Named counter that can be updated from any thread
+    class Counter {
+    private:
+        std::atomic<uint64_t> value{0}; // Current value
+
+    public:
+        void add(uint64_t amount = 1); // Increase the counter
+        void set(uint64_t amount); // Overwrite the counter (used for gauges)
+        void set_max(uint64_t amount); // Raise the counter to amount if it is lower (used for peaks)
+        uint64_t get() const; // Read the current value
+    };
+
+    Counter& counter(const std::string& name); // Returns the counter with the given name, creating it if needed
+    void report(); // Logs all counters
+} // namespace metrics
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <cstddef>
+
+namespace mime {
+    // Leaf part of a message as described by BODYSTRUCTURE
+    struct BodyPart {
+        std::string section; // IMAP section number (e.g. "1" or "2.1")
+        std::string type; // Media type in lowercase (e.g. "text")
+        std::string subtype; // Media subtype in lowercase (e.g. "html")
+        std::string encoding; // Content-Transfer-Encoding in lowercase (e.g. "base64")
+        std::string charset; // Charset parameter in lowercase, empty if not given
+        size_t size = 0; // Size of the encoded part in bytes
+    };
+
+    // Parses the BODYSTRUCTURE of a FETCH response into its leaf parts
+    std::vector<BodyPart> parse_bodystructure(const std::string& response);
+
+    // Selects the part most likely to hold the token (text/html before text/plain)
+    std::optional<BodyPart> select_text_part(const std::vector<BodyPart>& parts);
+
+    // Returns the unfolded value of a header field (name without the colon, any case), empty if it is missing
+    std::string header_value(const std::string& header, const std::string& name);
+
+    // Decodes RFC 2047 encoded words ("=?charset?B?...?=") in a header value to UTF-8
+    std::string decode_header_words(const std::string& value);
+
+    // Decodes a part body that arrives in chunks according to its transfer encoding and converts it to UTF-8.
+    // Base64 quads, quoted-printable escapes and UTF-8 sequences split between chunks are completed by the next one.
+    class TransferDecoder {
+    public:
+        TransferDecoder(const std::string& encoding, const std::string& charset = "");
+        std::string feed(std::string_view chunk); // Returns the text decoded from the chunk and what was held back before
+
+    private:
+        std::string encoding;
+        std::string charset;
+        bool multibyte; // The charset is UTF-8 (or ASCII), sequences may be split
+        std::string pending; // Encoded bytes that cannot be decoded yet
+        std::string tail; // Decoded bytes of an incomplete UTF-8 sequence
+    };
+} // namespace mime
\ No newline at end of file
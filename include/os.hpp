@@ -2,11 +2,63 @@
 
 #include <string>
 #include <optional>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
 
 namespace os {
-    const std::string os_name = "Windows"; // Operating system name
+    #ifdef _WIN32
+        const std::string os_name = "Windows"; // Operating system name
+    #else
+        const std::string os_name = "Linux"; // Operating system name
+    #endif
+
+    // Reason a wait returned
+    enum WaitResult {
+        WAIT_TIMEOUT, // The full time elapsed
+        WAIT_WAKE, // Another thread called wake_all()
+        WAIT_SHUTDOWN, // Shutdown was requested
+        WAIT_RELOAD, // Reload signal (SIGHUP), only reported to signal waiters
+        WAIT_REPORT // Report signal (SIGUSR1, Ctrl+Break on Windows), only reported to signal waiters
+    };
 
     std::optional<std::string> copy_to_clipboard(const std::string& data); // Function to copy data to clipboard
     void notify(const std::string& message, int delay = 10); // Function to send a notification
-    bool init();
-}
\ No newline at end of file
+    bool init(); // Must be called before any thread is started
+    void set_env(const std::string& name, const std::string& value); // Sets an environment variable of the process
+
+    WaitResult wait(long milliseconds, bool signals = false); // Interruptible sleep, signals are handled by a single thread
+    void wake_all(); // Wakes every waiting thread, a wake with no waiter is kept for its next wait
+    uint64_t wakes(); // Number of wake_all() calls so far, tells the threads woken by one call apart from a later one
+    void request_shutdown(); // Wakes every waiting thread for good
+    bool shutdown_requested();
+
+    // Local control socket (Unix domain socket, also on Windows 10 and later), only the user may connect.
+    // Answers one request line per connection until shutdown, returns false if the socket cannot be opened.
+    bool serve_local(const std::string& path, const std::function<std::string(const std::string&)>& handle);
+    std::optional<std::string> request_local(const std::string& path, const std::string& request); // Sends one request, nullopt if nobody listens
+
+    // Shared, writable memory mapping of a file. Not thread-safe, except that
+    // sync() may run while another thread writes into the mapping.
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string& path); // Opens or creates the file and maps all of it, throws on failure
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        char* data() const { return view; }
+        size_t size() const { return length; }
+        void resize(size_t size); // Grows the file and maps it again, pointers into the old mapping become invalid
+        bool sync(); // Writes the dirty pages to disk and waits until they are stored
+
+    private:
+        std::intptr_t file = -1; // Platform file handle
+        std::intptr_t mapping = 0; // Mapping handle (Windows only)
+        char* view = nullptr;
+        size_t length = 0;
+
+        void map();
+        void unmap();
+    };
+}
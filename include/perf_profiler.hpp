@@ -0,0 +1,47 @@
+#pragma once
+
+#include "defines.h"
+
+#include <string>
+
+// Hardware counters per poll stage, read with perf_event_open (enabled with PERF_PROFILING in defines.h, Linux only).
+// Counting only runs between start() and stop(), outside of that a stage change is a single relaxed load.
+// Counters are per thread, a stage change reads all of them with one syscall and charges the difference to the
+// stage that was left, so nested stages are not counted twice.
+namespace perf_profiler {
+    // Stage the CPU time is attributed to
+    enum Stage {
+        STAGE_OTHER,
+        STAGE_NETWORK, // Waiting for and parsing IMAP responses
+        STAGE_DECODE,
+        STAGE_EXTRACT,
+        STAGE_LOG,
+        STAGE_COUNT
+    };
+
+#if PERF_PROFILING && defined(__linux__)
+    // Attributes the counters of the current thread to a stage while in scope
+    class ScopedStage {
+    private:
+        Stage previous; // Stage to restore when leaving the scope
+        bool counting; // Profiling was running when the scope was entered
+
+    public:
+        explicit ScopedStage(Stage stage);
+        ~ScopedStage();
+
+        ScopedStage(const ScopedStage&) = delete; // Prevent copying
+        ScopedStage& operator=(const ScopedStage&) = delete; // Prevent assignment
+    };
+#else
+    // No-op when profiling is disabled
+    class ScopedStage {
+    public:
+        explicit ScopedStage(Stage) {}
+    };
+#endif
+
+    bool start(); // Resets the counters and starts counting, false if profiling is unavailable
+    void stop(); // Stops counting, the totals are kept for report()
+    std::string report(); // Counters per stage, also published as perf.<stage>.<counter> metrics
+} // namespace perf_profiler
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <random>
+#include <deque>
+#include <cstdint>
+
+// Adaptive polling scheduler for servers without IDLE.
+// Polls at the minimum interval while tokens are likely and backs off exponentially (with jitter) when idle.
+class PollScheduler {
+private:
+    using clock = std::chrono::steady_clock;
+
+    // Settings
+    long min_interval; // Shortest interval in milliseconds
+    long max_interval; // Longest interval in milliseconds
+    double backoff; // Factor the interval grows by after an empty poll
+    double jitter; // Random spread of the interval (0.2 = +-20%)
+    long hot_window; // Milliseconds after activity during which we poll at the minimum interval
+
+    // State
+    double current; // Current interval before jitter
+    clock::time_point last_activity; // Last arrival or activity hint
+    std::mt19937 rng; // Random generator for the jitter
+
+    // Statistics
+    uint64_t wakeups = 0; // Number of polls since start
+    clock::time_point start; // Start of the statistics
+    std::deque<long> latencies; // Most recent detection latencies in milliseconds
+
+public:
+    // Constructor
+    PollScheduler(long min_interval, long max_interval, double backoff = 2.0, double jitter = 0.2, long hot_window = 300000);
+
+    void on_poll(bool found); // Record a poll and whether it found new mail
+    void on_activity(); // Hint that a token is likely soon (e.g. new mail or a login attempt)
+    void record_latency(long milliseconds); // Record the time between arrival and detection of a token
+
+    long next_interval(); // Milliseconds to wait before the next poll
+    void report(const std::string& name); // Publish wakeups per hour and latency percentiles as metrics
+};
\ No newline at end of file
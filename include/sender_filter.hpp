@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+
+// Rule routing emails from a sender to an extraction profile.
+// Patterns containing '@' are exact addresses, "*@domain" matches the domain and its subdomains
+// and anything else is matched case-insensitively against the display name.
+struct SenderRule {
+    std::string pattern; // Sender pattern
+    std::string profile; // Name of the extraction profile
+};
+
+// Result of matching a From header against the rules
+struct SenderMatch {
+    std::string address; // Address of the sender in lowercase
+    std::string profile; // Name of the extraction profile
+};
+
+// Compiles sender rules into a single IMAP search and matches the results locally
+class SenderFilter {
+private:
+    std::vector<std::string> criteria; // One FROM search key per rule
+    std::unordered_map<std::string, std::string> addresses; // Exact addresses and their profiles
+    std::unordered_map<std::string, std::string> domains; // Domains and their profiles
+    std::vector<std::pair<std::string, std::string>> names; // Display name patterns and their profiles
+
+public:
+    // Constructor
+    SenderFilter(const std::vector<SenderRule>& rules);
+
+    // Returns one OR-combined search key covering all rules
+    std::string search_criteria() const;
+
+    // Matches a From header ("Name <user@domain>") against the rules
+    std::optional<SenderMatch> match(const std::string& from) const;
+};
\ No newline at end of file
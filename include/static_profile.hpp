@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// Characters a token of a compiled-in profile may consist of, combined as bit flags
+enum TokenAlphabet : unsigned {
+    TOKEN_DIGITS = 1 << 0, // 0-9
+    TOKEN_UPPER = 1 << 1, // A-Z
+    TOKEN_LOWER = 1 << 2, // a-z
+    TOKEN_ALNUM = TOKEN_DIGITS | TOKEN_UPPER | TOKEN_LOWER,
+    TOKEN_NEEDS_DIGIT = 1 << 3 // At least one digit, keeps letter alphabets from matching plain words
+};
+
+// Extraction profile known at build time, see STATIC_EXTRACTION_PROFILES.
+// Matches like \b([alphabet]{min_length,max_length})\b after the marker, on the normalized text.
+// The marker may be in an earlier run, mails usually put the token in an element of its own.
+struct StaticProfile {
+    char name[32]; // Name used by the sender rules
+    char marker[32]; // Text the token follows in the same or an earlier run, case-insensitive (empty for anywhere)
+    unsigned alphabet; // TokenAlphabet flags
+    unsigned min_length;
+    unsigned max_length;
+};
+
+namespace static_profile {
+    // Character classes of the lookup table
+    enum CharClass : uint8_t {
+        CLASS_WORD = 1 << 0, // Letter, digit or underscore, ends a token like \b
+        CLASS_TOKEN = 1 << 1, // Part of the alphabet
+        CLASS_DIGIT = 1 << 2
+    };
+
+    constexpr std::array<uint8_t, 256> make_table(unsigned alphabet) {
+        std::array<uint8_t, 256> table{};
+        for (int c = 0; c < 256; c++) {
+            bool digit = c >= '0' && c <= '9';
+            bool upper = c >= 'A' && c <= 'Z';
+            bool lower = c >= 'a' && c <= 'z';
+            bool token = (digit && (alphabet & TOKEN_DIGITS)) || (upper && (alphabet & TOKEN_UPPER)) || (lower && (alphabet & TOKEN_LOWER));
+            table[c] = (digit || upper || lower || c == '_' ? CLASS_WORD : 0) | (token ? CLASS_TOKEN : 0) | (digit ? CLASS_DIGIT : 0);
+        }
+        return table;
+    }
+
+    constexpr char lower(char c) {
+        return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+
+    // Position right after the first occurrence of the marker (ASCII case-insensitive), npos if there is none
+    template <StaticProfile P>
+    size_t after_marker(std::string_view text) {
+        constexpr std::string_view marker(P.marker);
+        if constexpr (marker.empty()) {
+            return 0;
+        } else {
+            for (size_t i = 0; i + marker.size() <= text.size(); i++) {
+                size_t j = 0;
+                while (j < marker.size() && lower(text[i + j]) == lower(marker[j])) {
+                    j++;
+                }
+                if (j == marker.size()) {
+                    return i + j;
+                }
+            }
+            return std::string_view::npos;
+        }
+    }
+
+    // Matcher specialized on the profile: the alphabet, the bounds and the marker are constants,
+    // so the loop is one table lookup per byte instead of a regex interpretation.
+    // marker_seen carries the marker over the runs of one body, it is set once a run contains the marker.
+    template <StaticProfile P>
+    std::optional<std::string_view> match(std::string_view text, bool& marker_seen) {
+        static constexpr std::array<uint8_t, 256> table = make_table(P.alphabet);
+        static_assert(P.min_length > 0 && P.min_length <= P.max_length, "Invalid token length in a static profile");
+
+        size_t pos = marker_seen ? 0 : after_marker<P>(text);
+        if (pos == std::string_view::npos) {
+            return std::nullopt; // No marker yet, the token cannot be in this run
+        }
+        marker_seen = true;
+
+        // Current run of word characters, it is a token if all of them are in the alphabet
+        size_t start = pos;
+        uint8_t all = CLASS_TOKEN; // AND of the classes in the run
+        uint8_t any = 0; // OR of the classes in the run
+        if (pos > 0 && (table[static_cast<unsigned char>(text[pos - 1])] & CLASS_WORD)) {
+            all = 0; // The marker ends inside a word, so does this run
+        }
+        for (size_t i = pos; i <= text.size(); i++) {
+            uint8_t cls = i < text.size() ? table[static_cast<unsigned char>(text[i])] : 0;
+            if (cls & CLASS_WORD) {
+                all &= cls;
+                any |= cls;
+                continue;
+            }
+            size_t length = i - start;
+            bool digit_ok = !(P.alphabet & TOKEN_NEEDS_DIGIT) || (any & CLASS_DIGIT);
+            if ((all & CLASS_TOKEN) && digit_ok && length >= P.min_length && length <= P.max_length) {
+                return text.substr(start, length);
+            }
+            start = i + 1;
+            all = CLASS_TOKEN;
+            any = 0;
+        }
+        return std::nullopt;
+    }
+} // namespace static_profile
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+#include <optional>
+
+// Bounded LRU cache with TTL, remembers processed emails and delivered tokens
+class TokenCache {
+private:
+    using clock = std::chrono::steady_clock;
+
+    size_t capacity; // Maximum number of entries
+    std::chrono::seconds ttl; // Lifetime of an entry
+
+    // Entry of the cache, the value is a small tag stored alongside the key
+    struct Entry {
+        std::string key;
+        std::string value;
+        clock::time_point inserted;
+    };
+
+    std::list<Entry> entries; // Entries, most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index; // Key lookup
+    std::mutex cache_mutex; // Mutex for thread safety
+
+public:
+    // Constructor
+    TokenCache(size_t capacity, std::chrono::seconds ttl);
+
+    std::optional<std::string> lookup(const std::string& key); // Returns the value of a live entry and counts hits and misses
+    void insert(const std::string& key, const std::string& value = ""); // Adds or refreshes an entry
+
+    // Key for an email, UIDs are only unique per mailbox and UIDVALIDITY
+    static std::string message_key(const std::string& mailbox, const std::string& uidvalidity, const std::string& uid);
+    // Key for a delivered token, hashed so the token itself is not kept in memory
+    static std::string token_key(const std::string& token, const std::string& sender);
+};
\ No newline at end of file
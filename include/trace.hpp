@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include "defines.h"
+
+// Scoped tracing spans (enabled with TRACING in defines.h).
+// Spans are kept in per-thread ring buffers and exported as Chrome trace_event JSON for Perfetto.
+namespace trace {
+#if TRACING
+    // Records the time between construction and destruction as a span
+    class Span {
+    private:
+        const char* name; // Name of the span, must be a string literal
+        std::string_view detail; // Additional detail (e.g. the IMAP command), copied when the span ends
+        uint64_t start; // Start time in microseconds
+
+    public:
+        explicit Span(const char* name, std::string_view detail = {});
+        ~Span();
+
+        Span(const Span&) = delete; // Prevent copying
+        Span& operator=(const Span&) = delete; // Prevent assignment
+    };
+#else
+    // No-op when tracing is disabled
+    class Span {
+    public:
+        explicit Span(const char*, std::string_view = {}) {}
+    };
+#endif
+
+    bool dump(const std::string& path); // Writes all buffered spans as Chrome trace_event JSON
+} // namespace trace
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Record types of a session transcript
+enum TranscriptRecord : char {
+    RECORD_COMMAND = 'C', // Command sent to the server (empty for the initial connect)
+    RECORD_HEADER = 'H', // Bytes passed to the header callback
+    RECORD_DATA = 'D', // Bytes passed to the write callback
+    RECORD_END = 'E' // End of the response, the bytes hold the CURLcode
+};
+
+// Writes a compact, timestamped transcript of an IMAP session.
+// Every record is "<type> <microseconds> <length>\n<bytes>\n", so arbitrary bytes can be stored.
+class TranscriptWriter {
+private:
+    std::ofstream out; // Transcript file
+    std::chrono::steady_clock::time_point start; // Start of the recording
+
+public:
+    // Constructor
+    TranscriptWriter(const std::string& path);
+
+    void write(TranscriptRecord type, const char* data, size_t length); // Append a record
+    void write(TranscriptRecord type, const std::string& data); // Append a record
+};
+
+// Reads a transcript written by TranscriptWriter
+class TranscriptReader {
+private:
+    std::ifstream in; // Transcript file
+
+public:
+    // Constructor
+    TranscriptReader(const std::string& path);
+
+    // Reads the next record, returns false at the end of the transcript
+    bool next(TranscriptRecord& type, uint64_t& time, std::string& data);
+};
\ No newline at end of file
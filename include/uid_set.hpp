@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <utility>
+#include <iterator>
+#include <cstdint>
+#include <cstddef>
+
+// Set of message UIDs stored as sorted, disjoint ranges.
+// Reads and writes the IMAP sequence-set syntax ("1:4,7,9:12", RFC 3501), so a run of
+// consecutive UIDs costs one range in memory and on the wire, however long it is.
+class UidSet {
+public:
+    using Range = std::pair<uint32_t, uint32_t>; // First and last UID, inclusive
+
+    // Iterates over the single UIDs in ascending order
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = uint32_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const uint32_t*;
+        using reference = uint32_t;
+
+        const_iterator() = default;
+        const_iterator(const std::vector<Range>* ranges, size_t index) : ranges(ranges), index(index), value(index < ranges->size() ? (*ranges)[index].first : 0) {}
+
+        uint32_t operator*() const { return value; }
+        const_iterator& operator++() {
+            if (value == (*ranges)[index].second) {
+                index++;
+                value = index < ranges->size() ? (*ranges)[index].first : 0;
+            } else {
+                value++;
+            }
+            return *this;
+        }
+        const_iterator operator++(int) { const_iterator old = *this; ++*this; return old; }
+        bool operator==(const const_iterator& other) const { return index == other.index && value == other.value; }
+
+    private:
+        const std::vector<Range>* ranges = nullptr;
+        size_t index = 0; // Current range
+        uint32_t value = 0; // Current UID
+    };
+
+    UidSet() = default;
+    UidSet(std::initializer_list<uint32_t> uids);
+
+    // Parses a sequence set ("1:4,7"), also accepts the space separated list of a SEARCH response.
+    // Throws std::invalid_argument on anything else, '*' is not allowed.
+    static UidSet parse(std::string_view text);
+
+    void insert(uint32_t uid);
+    void insert(uint32_t first, uint32_t last); // Inserts a range, merging it with overlapping and adjacent ones
+    void insert(const UidSet& other);
+    void clear();
+
+    bool contains(uint32_t uid) const; // Binary search over the ranges
+    bool empty() const;
+    uint64_t size() const; // Number of UIDs, not ranges
+    std::optional<uint32_t> min() const;
+    std::optional<uint32_t> max() const;
+    const std::vector<Range>& ranges() const;
+
+    std::string to_string() const; // Sequence set, empty if the set is empty
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    bool operator==(const UidSet& other) const = default;
+
+private:
+    std::vector<Range> spans; // Sorted, neither overlapping nor adjacent
+};
\ No newline at end of file
@@ -1,11 +1,34 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
+#include <cstddef>
 
 namespace base64
 {
     // Encodes a string to base64 format.
     std::string decode(const std::string &input);
-    std::string extract_base64_from_email(const std::string &input);
-} // namespace base64
\ No newline at end of file
+} // namespace base64
+
+namespace quoted_printable
+{
+    // Decodes quoted-printable data (=XX escapes, soft line breaks).
+    // An escape cut off at the end of a partial fetch is dropped.
+    std::string decode(const std::string &input);
+} // namespace quoted_printable
+
+namespace utf8
+{
+    // Length of the longest prefix that is valid UTF-8
+    size_t valid_prefix(std::string_view input);
+    bool is_valid(std::string_view input);
+    // Length of a multi-byte sequence cut off at the end of the input, 0 if the input ends on a boundary
+    size_t incomplete_tail(std::string_view input);
+    // Appends the UTF-8 encoding of a code point
+    void append(std::string &output, uint32_t codepoint);
+    // Converts text in the given charset (lowercase MIME name) to UTF-8.
+    // Supports UTF-8, US-ASCII, ISO-8859-1, ISO-8859-15 and Windows-1252, other charsets are returned unchanged.
+    std::string from_charset(const std::string &input, const std::string &charset);
+} // namespace utf8
\ No newline at end of file
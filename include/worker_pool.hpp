@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Runs many long-lived jobs (one per watched mailbox) on a fixed number of threads.
+// Every worker owns a shard of the jobs, kept as a heap ordered by the time each job is due next, and sleeps until
+// the earliest job of any shard is due. A worker without due jobs of its own steals the most overdue job of all other
+// shards and keeps it, so mailboxes that are busy or slow spread over the workers.
+// Steps block on their IMAP session, so a worker runs one step at a time: this bounds the threads, not the sessions,
+// and is sized for the mailboxes of one user or a small team rather than thousands of accounts.
+class WorkerPool {
+public:
+    // Job run one step at a time, only ever by one worker at once
+    class Job {
+    public:
+        virtual ~Job() = default;
+        // Runs the next step, woken is true after os::wake_all(). Returns the milliseconds until the job is due again.
+        virtual long step(bool woken) = 0;
+    };
+
+    // Constructor, 0 threads means one per core
+    explicit WorkerPool(size_t threads);
+
+    // Adds a job before run(), the shards are filled round robin
+    void add(std::unique_ptr<Job> job);
+
+    // Runs the workers until shutdown is requested
+    void run();
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // Job and the time it is due next
+    struct Entry {
+        clock::time_point due;
+        bool woken = false; // Due because of a wake
+        uint64_t wakes = 0; // os::wakes() when the last step started, that step already saw these wakes
+        std::unique_ptr<Job> job;
+    };
+
+    // Jobs of one worker
+    struct Shard {
+        std::mutex mutex; // Mutex for the heap, other workers steal from it
+        std::vector<Entry> jobs; // Heap, earliest due first
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards; // One shard per worker
+    size_t next_shard = 0; // Shard the next added job goes to
+
+    void work(size_t index); // Loop of one worker
+    bool take_due(Shard& shard, clock::time_point now, Entry& entry); // Pops the earliest job if it is due
+    bool steal(size_t index, clock::time_point now, Entry& entry); // Pops the most overdue job of the other shards
+    void push(Shard& shard, Entry entry);
+    clock::time_point earliest_due(); // Earliest due time of all shards
+    void wake_jobs(uint64_t wakes); // Makes every waiting job due now that has not seen this many wakes
+};
\ No newline at end of file
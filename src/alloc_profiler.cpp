@@ -0,0 +1,199 @@
+#include "alloc_profiler.hpp"
+#include "logger.hpp"
+
+#if ALLOC_PROFILING
+
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Counters of a stage, only atomics so the hooks never allocate or lock
+struct StageStats {
+    std::atomic<uint64_t> allocations{0}; // Number of allocations
+    std::atomic<uint64_t> bytes{0}; // Number of allocated bytes
+    std::atomic<int64_t> live{0}; // Bytes currently allocated
+    std::atomic<int64_t> peak{0}; // Highest number of live bytes
+};
+
+// Per-cycle statistics, updated in end_cycle()
+struct CycleStats {
+    uint64_t last_allocations = 0; // Allocations at the end of the previous cycle
+    uint64_t last_bytes = 0; // Bytes at the end of the previous cycle
+    uint64_t max_allocations = 0; // Most allocations in a single cycle
+    uint64_t max_bytes = 0; // Most bytes in a single cycle
+};
+
+static StageStats stage_stats[alloc_profiler::STAGE_COUNT];
+static StageStats total_stats; // All stages together
+static CycleStats cycle_stats[alloc_profiler::STAGE_COUNT];
+static uint64_t cycles = 0; // Number of completed poll cycles
+static std::mutex cycle_mutex; // Mutex for the per-cycle statistics
+
+static thread_local alloc_profiler::Stage current_stage = alloc_profiler::STAGE_OTHER;
+
+static const char* stage_names[alloc_profiler::STAGE_COUNT] = {"other", "search", "fetch", "decode", "extract", "log"};
+
+// Header stored in front of every block, keeps the size and stage for the matching delete
+struct alignas(std::max_align_t) BlockHeader {
+    size_t size;
+    alloc_profiler::Stage stage;
+};
+
+// Raises the peak to the current value if it is higher
+static void update_peak(std::atomic<int64_t>& peak, int64_t value) {
+    int64_t current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+static void record_allocation(StageStats& stats, size_t size) {
+    stats.allocations.fetch_add(1, std::memory_order_relaxed);
+    stats.bytes.fetch_add(size, std::memory_order_relaxed);
+    update_peak(stats.peak, stats.live.fetch_add(size, std::memory_order_relaxed) + static_cast<int64_t>(size));
+}
+
+static void* counted_alloc(size_t size) {
+    void* block = std::malloc(size + sizeof(BlockHeader));
+    if (block == nullptr) {
+        return nullptr;
+    }
+
+    BlockHeader* header = static_cast<BlockHeader*>(block);
+    header->size = size;
+    header->stage = current_stage;
+    record_allocation(stage_stats[current_stage], size);
+    record_allocation(total_stats, size);
+
+    return header + 1; // User data starts after the header
+}
+
+static void counted_free(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    // Freed bytes go back to the stage that allocated them
+    BlockHeader* header = static_cast<BlockHeader*>(ptr) - 1;
+    stage_stats[header->stage].live.fetch_sub(header->size, std::memory_order_relaxed);
+    total_stats.live.fetch_sub(header->size, std::memory_order_relaxed);
+    std::free(header);
+}
+
+// ===================================
+// Global allocation hooks
+// ===================================
+void* operator new(size_t size) {
+    void* ptr = counted_alloc(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    void* ptr = counted_alloc(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return counted_alloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return counted_alloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    counted_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    counted_free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    counted_free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    counted_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    counted_free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    counted_free(ptr);
+}
+
+// ===================================
+// Stage tracking and reporting
+// ===================================
+alloc_profiler::ScopedStage::ScopedStage(Stage stage) : previous(current_stage) {
+    current_stage = stage;
+}
+
+alloc_profiler::ScopedStage::~ScopedStage() {
+    current_stage = previous;
+}
+
+void alloc_profiler::end_cycle() {
+    std::lock_guard<std::mutex> lock(cycle_mutex); // Lock the mutex for thread safety
+    cycles++;
+
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        uint64_t allocations = stage_stats[i].allocations.load(std::memory_order_relaxed);
+        uint64_t bytes = stage_stats[i].bytes.load(std::memory_order_relaxed);
+        CycleStats& cycle = cycle_stats[i];
+
+        // Keep the worst cycle of each stage
+        cycle.max_allocations = std::max(cycle.max_allocations, allocations - cycle.last_allocations);
+        cycle.max_bytes = std::max(cycle.max_bytes, bytes - cycle.last_bytes);
+        cycle.last_allocations = allocations;
+        cycle.last_bytes = bytes;
+    }
+}
+
+void alloc_profiler::report() {
+    ScopedStage stage(STAGE_LOG); // The report itself is logging
+
+    std::string report = "Allocation profile after " + std::to_string(cycles) + " poll cycles:";
+    uint64_t divisor = cycles > 0 ? cycles : 1;
+
+    std::lock_guard<std::mutex> lock(cycle_mutex); // Lock the mutex for thread safety
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const StageStats& stats = stage_stats[i];
+        uint64_t allocations = stats.allocations.load(std::memory_order_relaxed);
+        uint64_t bytes = stats.bytes.load(std::memory_order_relaxed);
+
+        report += "\n    " + std::string(stage_names[i]) + ": " +
+            std::to_string(allocations / divisor) + " allocs/cycle (max " + std::to_string(cycle_stats[i].max_allocations) + "), " +
+            std::to_string(bytes / divisor) + " bytes/cycle (max " + std::to_string(cycle_stats[i].max_bytes) + "), " +
+            "live " + std::to_string(stats.live.load(std::memory_order_relaxed)) + " bytes, " +
+            "peak " + std::to_string(stats.peak.load(std::memory_order_relaxed)) + " bytes";
+    }
+    report += "\n    total: " + std::to_string(total_stats.allocations.load(std::memory_order_relaxed)) + " allocs, " +
+        std::to_string(total_stats.bytes.load(std::memory_order_relaxed)) + " bytes, " +
+        "peak " + std::to_string(total_stats.peak.load(std::memory_order_relaxed)) + " bytes";
+
+    Logger::logger().info(report);
+}
+
+#else
+
+void alloc_profiler::end_cycle() {
+}
+
+void alloc_profiler::report() {
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "compression.hpp"
+
+#include <stdexcept>
+
+// Size of the intermediate output buffer used for each zlib call
+static constexpr size_t CHUNK_SIZE = 16384;
+
+// ===================================
+// Deflater
+// ===================================
+compression::Deflater::Deflater(int level) : stream{} {
+    // Negative window bits select a raw deflate stream without zlib header
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialize deflate stream.");
+    }
+}
+
+compression::Deflater::~Deflater() {
+    deflateEnd(&stream); // Release the zlib state
+}
+
+void compression::Deflater::compress(const char* data, size_t length, std::string& out) {
+    char buffer[CHUNK_SIZE];
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data)); // zlib does not modify the input
+    stream.avail_in = static_cast<uInt>(length);
+
+    // Z_SYNC_FLUSH pushes out everything so a whole command can be decoded by the server
+    do {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = CHUNK_SIZE;
+
+        int res = deflate(&stream, Z_SYNC_FLUSH);
+        if (res != Z_OK && res != Z_BUF_ERROR) {
+            throw std::runtime_error("Failed to deflate data.");
+        }
+
+        out.append(buffer, CHUNK_SIZE - stream.avail_out); // Append the compressed output
+    } while (stream.avail_out == 0); // A full buffer means there may be more output pending
+}
+
+// ===================================
+// Inflater
+// ===================================
+compression::Inflater::Inflater() : stream{} {
+    // Negative window bits select a raw deflate stream without zlib header
+    if (inflateInit2(&stream, -15) != Z_OK) {
+        throw std::runtime_error("Failed to initialize inflate stream.");
+    }
+}
+
+compression::Inflater::~Inflater() {
+    inflateEnd(&stream); // Release the zlib state
+}
+
+void compression::Inflater::decompress(const char* data, size_t length, std::string& out) {
+    char buffer[CHUNK_SIZE];
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data)); // zlib does not modify the input
+    stream.avail_in = static_cast<uInt>(length);
+
+    do {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = CHUNK_SIZE;
+
+        int res = inflate(&stream, Z_SYNC_FLUSH);
+        if (res == Z_NEED_DICT || res == Z_DATA_ERROR || res == Z_MEM_ERROR || res == Z_STREAM_ERROR) {
+            throw std::runtime_error("Failed to inflate data: corrupt compressed stream.");
+        }
+
+        out.append(buffer, CHUNK_SIZE - stream.avail_out); // Append the decompressed output
+
+        if (res == Z_STREAM_END) {
+            break; // The server ended the compression layer, nothing more to decode
+        }
+    } while (stream.avail_in > 0 || stream.avail_out == 0); // Continue until all input is consumed and output drained
+}
\ No newline at end of file
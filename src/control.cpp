@@ -0,0 +1,181 @@
+#include "control.hpp"
+#include "history.hpp"
+#include "os.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "perf_profiler.hpp"
+#include "defines.h"
+
+#include <mutex>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    std::mutex arm_mutex; // Guards the arm state below
+    bool is_armed = false;
+    std::string armed_sender; // Lowercase sender pattern, empty for any
+    clock::time_point armed_until;
+
+    std::string lowercase(std::string text) {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+        return text;
+    }
+
+    // Same address forms as the sender rules, the address is already lowercase
+    bool sender_matches(const std::string& pattern, const std::string& address) {
+        if (pattern.empty() || pattern == address) {
+            return true;
+        }
+        return pattern.starts_with("*@") && address.ends_with(pattern.substr(1));
+    }
+
+    bool is_number(const std::string& text) {
+        return !text.empty() && std::all_of(text.begin(), text.end(), [](unsigned char c) { return std::isdigit(c); });
+    }
+
+    std::string format_time(std::time_t time) {
+        if (time == 0) {
+            return "never";
+        }
+        char buffer[32];
+        std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S UTC", std::gmtime(&time));
+        return buffer;
+    }
+}
+
+void control::arm(const std::string& sender, std::chrono::seconds window) {
+    {
+        std::lock_guard<std::mutex> lock(arm_mutex);
+        is_armed = true;
+        armed_sender = lowercase(sender);
+        armed_until = clock::now() + window;
+    }
+    Logger::logger().info("Armed for " + (sender.empty() ? std::string("any sender") : sender) + " for " + std::to_string(window.count()) + " seconds.");
+    metrics::counter("control.arms").add();
+    os::wake_all(); // Poll right away, which also finds a dead session before the token arrives
+}
+
+void control::disarm() {
+    std::lock_guard<std::mutex> lock(arm_mutex);
+    if (is_armed) {
+        is_armed = false;
+        Logger::logger().info("Disarmed.");
+    }
+}
+
+bool control::armed() {
+    std::lock_guard<std::mutex> lock(arm_mutex);
+    if (is_armed && clock::now() >= armed_until) {
+        is_armed = false;
+        Logger::logger().info("Disarmed, no token arrived in time.");
+        metrics::counter("control.arm_timeouts").add();
+    }
+    return is_armed;
+}
+
+void control::on_token(const std::string& sender) {
+    std::lock_guard<std::mutex> lock(arm_mutex);
+    if (is_armed && sender_matches(armed_sender, sender)) {
+        is_armed = false;
+        Logger::logger().info("Disarmed after the token of " + sender + ".");
+    }
+}
+
+std::string control::handle(const std::string& request, const TokenHistory* history) {
+    std::istringstream in(request);
+    std::string command;
+    in >> command;
+
+    if (command == "arm") {
+        std::string sender, window;
+        in >> sender >> window;
+        if (window.empty() && is_number(sender)) {
+            std::swap(sender, window); // "arm 60" arms for any sender
+        }
+        long seconds = window.empty() ? ARM_WINDOW : (is_number(window) && window.size() < 6 ? std::stol(window) : 0);
+        if (seconds <= 0 || seconds > 86400) {
+            return "error: the window must be 1 to 86400 seconds\n";
+        }
+        arm(sender, std::chrono::seconds(seconds));
+        return "armed\n";
+    }
+    if (command == "disarm") {
+        disarm();
+        return "disarmed\n";
+    }
+    if (command == "status") {
+        if (!armed()) {
+            return "idle\n";
+        }
+        std::lock_guard<std::mutex> lock(arm_mutex);
+        auto left = std::chrono::ceil<std::chrono::seconds>(armed_until - clock::now()).count();
+        return "armed for " + (armed_sender.empty() ? std::string("any sender") : armed_sender) + ", " + std::to_string(left) + " seconds left\n";
+    }
+    if (command == "last") {
+        std::string sender;
+        in >> sender;
+        if (sender.empty()) {
+            return "error: usage: last <sender>\n";
+        }
+        if (!history) {
+            return "error: the token history is disabled\n";
+        }
+        std::optional<HistoryEntry> entry = history->last(lowercase(sender));
+        if (!entry.has_value()) {
+            return "none\n";
+        }
+        return entry->token + " received " + format_time(entry->received) + " delivered " + format_time(entry->delivered) + " in " + entry->mailbox + "\n";
+    }
+    if (command == "recent") {
+        std::string window;
+        in >> window;
+        long seconds = window.empty() ? 3600 : (is_number(window) && window.size() < 9 ? std::stol(window) : 0);
+        if (seconds <= 0) {
+            return "error: usage: recent [seconds]\n";
+        }
+        if (!history) {
+            return "error: the token history is disabled\n";
+        }
+        std::time_t now = std::time(nullptr);
+        std::vector<HistoryEntry> entries = history->between(now - seconds, now);
+        std::string response = std::to_string(entries.size()) + " of " + std::to_string(history->size()) + " tokens arrived in the last " + std::to_string(seconds) + " seconds\n";
+        for (const HistoryEntry& entry : entries) {
+            response += entry.token + " from " + entry.sender + " received " + format_time(entry.received) + " delivered " + format_time(entry.delivered) + " in " + entry.mailbox + "\n";
+        }
+        return response;
+    }
+    if (command == "profile") {
+        std::string action;
+        in >> action;
+        if (action == "start") {
+            return perf_profiler::start() ? "profiling\n" : "error: CPU profiling is not available (PERF_PROFILING, Linux only)\n";
+        }
+        if (action == "stop") {
+            perf_profiler::stop();
+        } else if (!action.empty()) {
+            return "error: usage: profile [start|stop]\n";
+        }
+        return perf_profiler::report() + "\n";
+    }
+    return "error: unknown command, expected arm, disarm, status, last, recent or profile\n";
+}
+
+int control::run_client(const std::vector<std::string>& args) {
+    std::string request;
+    for (const std::string& arg : args) {
+        request += (request.empty() ? "" : " ") + arg;
+    }
+
+    std::optional<std::string> response = os::request_local(CONTROL_SOCKET_PATH, request);
+    if (!response.has_value()) {
+        std::cerr << "The daemon is not running (no control socket at " << CONTROL_SOCKET_PATH << ")." << std::endl;
+        return 1;
+    }
+    std::cout << response.value();
+    return response.value().starts_with("error") ? 1 : 0;
+}
\ No newline at end of file
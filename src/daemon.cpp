@@ -1,7 +1,21 @@
 #include "imap_handler.hpp"
 #include "os.hpp"
 #include "utils.hpp"
+#include "mime.hpp"
+#include "scheduler.hpp"
+#include "sender_filter.hpp"
+#include "header_filter.hpp"
+#include "extraction.hpp"
+#include "static_profile.hpp"
+#include "token_cache.hpp"
+#include "history.hpp"
+#include "control.hpp"
+#include "worker_pool.hpp"
+#include "alloc_profiler.hpp"
+#include "perf_profiler.hpp"
+#include "trace.hpp"
 #include "logger.hpp"
+#include "metrics.hpp"
 #include "defines.h"
 
 #include <string>
@@ -10,153 +24,294 @@
 #include <regex>
 #include <ctime>
 #include <sstream>
-#include <iomanip>
 #include <optional>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <initializer_list>
+
+const SenderFilter sender_filter(std::vector<SenderRule> SENDER_RULES); // Trusted senders and their extraction profiles
+const HeaderFilter header_filter(std::vector<std::string> SUBJECT_REQUIRED, std::vector<std::string> SUBJECT_IGNORED, TIME_DIFFERENCE); // Emails worth a body fetch
+TokenCache token_cache(TOKEN_CACHE_SIZE, std::chrono::seconds(TIME_DIFFERENCE)); // Processed emails and delivered tokens
+std::map<std::string, mime::BodyPart> part_cache; // Body part holding the token, cached per sender
+std::mutex part_cache_mutex; // Mutex for the part cache, shared by all mailbox watchers
+std::mutex delivery_mutex; // Mutex for the delivery queue
+std::condition_variable delivery_cv; // Signals a queued token or the end of the delivery thread
+std::deque<HistoryEntry> delivery_queue; // Tokens waiting for the clipboard, oldest first
+bool delivery_stopping = false; // Set on shutdown, ends the paste window right away
+std::unique_ptr<TokenHistory> token_history; // Audit trail of delivered tokens, null if disabled
+std::shared_ptr<CancelToken> cancel_token = std::make_shared<CancelToken>(); // Aborts the IMAP operations of every handler
+
+
+constexpr std::initializer_list<StaticProfile> static_profiles = STATIC_EXTRACTION_PROFILES; // Profiles known at build time
+
+// One specialized matcher per static profile
+template <size_t... I>
+std::vector<ExtractionProfile> specialized_profiles(std::index_sequence<I...>) {
+    return {ExtractionProfile(static_profiles.begin()[I].name, &static_profile::match<static_profiles.begin()[I]>)...};
+}
 
-IMAPHandler* handler; // Global IMAP handler object
+// Returns the extraction profile with the given name
+const ExtractionProfile* find_profile(const std::string& name) {
+    static const std::vector<ExtractionProfile> profiles = [] {
+        // Specialized profiles come first, so they win over a regex profile of the same name
+        std::vector<ExtractionProfile> result = specialized_profiles(std::make_index_sequence<static_profiles.size()>());
+        for (const auto& [profile_name, pattern] : std::vector<std::pair<std::string, std::string>> EXTRACTION_PROFILES) {
+            result.emplace_back(profile_name, pattern); // Compile the regex once
+        }
+        return result;
+    }();
 
+    for (const ExtractionProfile& profile : profiles) {
+        if (profile.name == name) {
+            return &profile;
+        }
+    }
+    return nullptr;
+}
 
-bool check_timestamp(std::string uid){
-    Response res = handler->fetch_internaldate(uid); // Fetch the internal date of the email
-    Logger::logger().debug("Checking timestamp for UID: " + uid); // Log the UID being checked
+std::optional<std::string> get_token(IMAPHandler& handler, std::string uid, const std::string& sender, const ExtractionProfile& profile){
+    trace::Span span("get_token", uid);
+    Logger::logger().debug("Checking email with UID: " + uid); // Log the UID being checked
 
-    std::regex code_regex(R"(\bINTERNALDATE\s\"(\d{2}-[A-Za-z]{3}-\d{4}\s\d{2}:\d{2}:\d{2}\s[+-]\d{4})\")"); // Regex to match the date and time
-    std::smatch match; // Match object to store the result of regex search
+    // Find the part holding the token, senders use the same layout for every mail
+    std::optional<mime::BodyPart> cached_part;
+    {
+        std::lock_guard<std::mutex> lock(part_cache_mutex);
+        if (part_cache.contains(sender)) {
+            cached_part = part_cache[sender];
+        }
+    }
+    bool cached = cached_part.has_value();
+    if (!cached) {
+        Response res = handler.fetch_bodystructure(uid); // Fetch the MIME structure of the email
+        cached_part = mime::select_text_part(mime::parse_bodystructure(res.header));
+        if (!cached_part.has_value()) {
+            Logger::logger().error("No text part found in email."); // Log error if there is no text part
+            return std::nullopt;
+        }
+        std::lock_guard<std::mutex> lock(part_cache_mutex);
+        part_cache[sender] = cached_part.value(); // Remember the part for the next email of this sender
+    }
+    const mime::BodyPart part = cached_part.value();
+    Logger::logger().debug("Using part " + part.section + " (" + part.type + "/" + part.subtype + ", " + part.encoding + ")"); // Log the selected part
+
+    // Decode and scan the part while it arrives, the rest is skipped once the token is confirmed
+    mime::TransferDecoder decoder(part.encoding, part.charset);
+    TokenScanner scanner(profile, part.subtype == "html");
+    size_t received = 0;
+    bool confirmed = false;
+    handler.fetch_body_streaming(uid, part.section, BODY_FETCH_LIMIT, [&](std::string_view chunk) {
+        received += chunk.size();
+        confirmed = scanner.feed(decoder.feed(chunk));
+        return !confirmed;
+    });
+
+    // A confirmed token cannot be beaten, otherwise the best match is only certain if the whole part was scanned
+    bool complete = received < BODY_FETCH_LIMIT;
+    std::optional<std::string> token = confirmed || complete ? scanner.finish() : scanner.confirmed();
+    Logger::logger().debug("Scanned " + std::to_string(received) + " bytes of the body."); // Log how much of the body was needed
+    if (token.has_value()) {
+        Logger::logger().info("Token found: " + token.value()); // Log the found token
+        return token; // Return the token if found
+    }
 
-    if (!std::regex_search(res.data, match, code_regex)) { // Search for the regex pattern in the response data
-        Logger::logger().error("Failed to find timestamp in response data."); // Log error if timestamp is not found
-        return false; // Return false if timestamp is not found
+    // The sender may have changed its layout, retry once with a fresh structure
+    if (cached) {
+        Logger::logger().debug("No token in cached part, refreshing body structure."); // Log the cache invalidation
+        {
+            std::lock_guard<std::mutex> lock(part_cache_mutex);
+            part_cache.erase(sender);
+        }
+        return get_token(handler, uid, sender, profile);
     }
 
-    Logger::logger().debug("Timestamp found: " + match.str(1)); // Log the found timestamp
-    std::string timestamp = match.str(1); // Extract the timestamp from the match
+    return std::nullopt; // Return nullopt if no token is found
+}   
 
-    std::tm tm = {}; // Initialize a tm structure to hold the parsed time
-    std::istringstream ss(timestamp); // Create a string stream from the timestamp string
-    ss >> std::get_time(&tm, "%d-%b-%Y %H:%M:%S"); // Parse the timestamp into the tm structure
+// Copies the token to the clipboard and restores the old content afterwards
+bool paste_token(const std::string& token) {
+    std::optional<std::string> old_clipboard;
 
-    // Check if parsing failed
-    if (ss.fail()) {
-        Logger::logger().error("Failed to parse timestamp: " + timestamp); // Log error if parsing fails
-        return false; // Return false if parsing fails
-    }
+    for(int i = 0; i < CLIPBOARD_RETRY; i++){
+        old_clipboard = os::copy_to_clipboard(token);
+        
+        if(old_clipboard.has_value()){
+            break;
+        }
 
-    std::time_t email_time = std::mktime(&tm); // Convert the tm structure to time_t
-    Logger::logger().debug("Email time (UTC): " + std::to_string(email_time)); // Log the email time in UTC
+        os::wait(2);
+    }
 
-    // Get the current UTC time as a time_t object
-    std::time_t now = std::time(nullptr); // Get the current time
-    Logger::logger().debug("Current time (UTC): " + std::to_string(now)); // Log the current time in UTC
+    if(!old_clipboard.has_value()) {
+        Logger::logger().error("Failed to copy token to clipboard."); // Log error if copying fails
+        
+        os::notify("Unable to copy token to clipboard! Token: " + token);
+        return false;
+    }
 
-    // Calculate the time difference between now and the email time
-    double diff = std::difftime(now, email_time); // Calculate the difference in seconds
-    Logger::logger().debug("Time difference: " + std::to_string(diff)); // Log the time difference
+    Logger::logger().warning("Token copied to clipboard: " + token); // Log success if token is copied
+    os::notify("Token copied!");
 
-    // Check if the email is within the last TIME_DIFFERENCE seconds
-    if (diff <= TIME_DIFFERENCE && diff >= 0) { // Check if the email is recent
-        Logger::logger().info("Email is recent (within the last " + std::to_string(TIME_DIFFERENCE) + " seconds)."); // Log if the email is recent
-        return true; // Return true if the email is recent
-    } else {
-        Logger::logger().info("Email is not recent."); // Log if the email is not recent
+    // Give user 10 seconds to paste token, a shutdown restores right away
+    {
+        std::unique_lock<std::mutex> lock(delivery_mutex);
+        delivery_cv.wait_for(lock, std::chrono::seconds(10), [] { return delivery_stopping; });
     }
-    return false; // Return false if the email is not recent
+    os::copy_to_clipboard(old_clipboard.value()); // Restore the old clipboard content
+    Logger::logger().warning("Clipboard restored."); // Log restoration of clipboard
+    return true;
 }
 
-std::optional<std::string> get_token(std::string uid){
-    Response res = handler->fetch_body(uid, 1); // Fetch the body of the email
-    Logger::logger().debug("Checking email with UID: " + uid); // Log the UID being checked
-
-    // Decoding email body from base64
-    std::string base64_body = base64::extract_base64_from_email(res.header); // Extract the base64 encoded body from the email
-    Logger::logger().debug("Base64 encoded email body: " + base64_body); // Log the base64 encoded email body
-    std::string decoded_body = base64::decode(base64_body); // Decode the base64 body
-    Logger::logger().debug("Decoded email body: " + decoded_body); // Log the decoded email body
+// Queues a token for the clipboard, the watcher goes on while the user pastes
+void deliver_token(const HistoryEntry& entry) {
+    std::lock_guard<std::mutex> lock(delivery_mutex);
+    delivery_queue.push_back(entry);
+    delivery_cv.notify_one();
+}
 
-    std::regex code_regex(R"(<p><b>(\d{6})</b></p>)"); // Regex to match a 6-digit number enclosed with * *
-    std::smatch match;
+// Delivery thread, pastes one token after the other so the user has time for each, and records them in the history
+void deliver_tokens() {
+    while (true) {
+        HistoryEntry entry;
+        {
+            std::unique_lock<std::mutex> lock(delivery_mutex);
+            delivery_cv.wait(lock, [] { return delivery_stopping || !delivery_queue.empty(); });
+            if (delivery_stopping) {
+                if (!delivery_queue.empty()) {
+                    Logger::logger().warning("Dropped " + std::to_string(delivery_queue.size()) + " undelivered tokens on shutdown.");
+                }
+                return;
+            }
+            entry = std::move(delivery_queue.front());
+            delivery_queue.pop_front();
+        }
 
-    if (std::regex_search(decoded_body, match, code_regex)) {
-        Logger::logger().info("Token found: " + match.str(1)); // Log the found token
-        std::string token = match.str(1); // Extract the token from the match
-        return token; // Return the token if found
+        entry.delivered = std::time(nullptr); // The token is copied right away, the paste wait follows
+        if (!paste_token(entry.token)) {
+            entry.delivered = 0;
+        }
+        if (token_history) {
+            token_history->append(entry);
+        }
     }
+}
 
-    return std::nullopt; // Return nullopt if no token is found
-}   
+// Checks the selected mailbox once, returns true if new emails that may hold a token were found
+bool poll_mailbox(IMAPHandler& handler, PollScheduler& scheduler, const std::string& mailbox) {
+    Logger::logger().debug("Checking for new emails in " + mailbox + "..."); // Log the start of email checking
+    auto cycle_start = std::chrono::steady_clock::now(); // Start of this poll cycle
+    UidSet candidates = handler.search(sender_filter.search_criteria()); // One search covering all trusted senders
+
+    // Skip emails we already processed (e.g. deletion failed or we reconnected) before fetching anything
+    UidSet uids; // Emails of trusted senders, deleted at the end of the cycle
+    UidSet fresh; // Emails that were not seen before
+    for (uint32_t uid : candidates) {
+        std::optional<std::string> seen = token_cache.lookup(TokenCache::message_key(mailbox, handler.get_uidvalidity(), std::to_string(uid)));
+        if (!seen.has_value()) {
+            fresh.insert(uid);
+        } else if (seen.value() == "delete") {
+            uids.insert(uid); // Processed before, only the deletion is missing
+        }
+    }
 
-void main_loop() {
-    handler->connect(); // Connect to the IMAP server
-    Logger::logger().info("Connected to IMAP server."); // Log connection to the server
+    // Route every email to the profile of its sender and drop the ones that cannot hold a token, all from one header fetch.
+    // The server search is only a coarse prefilter.
+    std::map<uint32_t, HeaderFields> fetched = handler.fetch_header_fields(fresh, "FROM SUBJECT DATE CONTENT-TYPE");
+    std::vector<uint32_t> uids_copy; // Emails that still need to be processed, oldest first
+    std::map<uint32_t, SenderMatch> senders;
+    std::map<uint32_t, std::time_t> arrivals; // INTERNALDATE of the emails to process
+    std::time_t now = std::time(nullptr);
+    for (uint32_t uid : fresh) {
+        std::string key = TokenCache::message_key(mailbox, handler.get_uidvalidity(), std::to_string(uid));
+        MessageHeaders headers = MessageHeaders::parse(fetched[uid].fields, fetched[uid].internaldate);
+        std::optional<SenderMatch> sender = sender_filter.match(headers.from);
+        if (!sender.has_value()) {
+            token_cache.insert(key, "ignore"); // Not a trusted sender, leave it alone
+            continue;
+        }
 
-    // Selecting INBOX
-    handler->select("INBOX");
-    Logger::logger().info("Selected INBOX."); // Log selection of INBOX
+        std::optional<std::string> reason = header_filter.reject(headers, now);
+        if (reason.has_value()) {
+            Logger::logger().info("Skipping email " + std::to_string(uid) + " (\"" + headers.subject + "\"): " + reason.value() + "."); // Log why no body is fetched
+            metrics::counter("daemon.prefiltered").add();
+            if (headers.received != 0 && std::difftime(now, headers.received) > TIME_DIFFERENCE) {
+                uids.insert(uid); // Outdated token mails are deleted like before
+                token_cache.insert(key, "delete");
+            } else {
+                token_cache.insert(key, "ignore"); // Other mail of a trusted sender, leave it alone
+            }
+            continue;
+        }
 
-    while(true) {
-        Logger::logger().debug("Checking for new emails..."); // Log the start of email checking
-        std::vector<std::string> uids = handler->search_from(TARGET_MAIL_ADDRESS); // Search for unseen emails from the target address
-        std::vector<std::string> uids_copy = uids; // Copy the uids vector to avoid modifying it while iterating
+        uids.insert(uid);
+        uids_copy.push_back(uid);
+        senders[uid] = sender.value();
+        arrivals[uid] = headers.received;
+    }
 
-        if(uids.empty()) {
-            Logger::logger().debug("No new emails found."); // Log if no new emails are found
+    // Emails cached for deletion or skipped as outdated are not new, a deletion that keeps failing must not hold the fast mode
+    bool found = !uids_copy.empty();
+    if(!found) {
+        Logger::logger().debug("No new emails found."); // Log if no new emails are found
+    } else {
+        Logger::logger().debug("Found " + std::to_string(uids_copy.size()) + " new emails in " + mailbox + "."); // Log the number of new emails found
+    }
+    scheduler.on_poll(found); // New mail keeps the scheduler in fast mode
+
+    // Iterate through UIDs
+    while(!uids_copy.empty()) {
+        const SenderMatch& sender = senders[uids_copy.back()];
+        std::string uid = std::to_string(uids_copy.back());
+        std::string key = TokenCache::message_key(mailbox, handler.get_uidvalidity(), uid);
+        const ExtractionProfile* profile = find_profile(sender.profile);
+        std::time_t email_time = arrivals[uids_copy.back()];
+        if(profile == nullptr) {
+            Logger::logger().error("Unknown extraction profile: " + sender.profile); // Log error if the rules reference a missing profile
         } else {
-            Logger::logger().debug("Found " + std::to_string(uids.size()) + " new emails."); // Log the number of new emails found
-        }
-
-        // Iterate through UIDs
-        while(!uids_copy.empty()) {
-            std::string uid = uids_copy.back();
-            if(check_timestamp(uid)) {
-                std::optional<std::string> token = get_token(uid); // Get the token from the email
-                if(token.has_value()) {
-                    std::optional<std::string> old_clipboard;
-
-                    for(int i = 0; i < CLIPBOARD_RETRY; i++){
-                        old_clipboard = os::copy_to_clipboard(token.value());
-                        
-                        if(old_clipboard.has_value()){
-                            break;
-                        }
-
-                        Sleep(2);
-                    }
-
-                    if(!old_clipboard.has_value()) {
-                        Logger::logger().error("Failed to copy token to clipboard."); // Log error if copying fails
-                        
-                        os::notify("Unable to copy token to clipboard! Token: " + token.value());
-                        break; // Exit the loop if copying fails
-                    }
-
-                    Logger::logger().warning("Token copied to clipboard: " + token.value()); // Log success if token is copied
-                    os::notify("Token copied!");
-
-                    Sleep(10000); // Give user 10 seconds to paste token
-                    os::copy_to_clipboard(old_clipboard.value()); // Restore the old clipboard content
-                    Logger::logger().warning("Clipboard restored."); // Log restoration of clipboard
-                    break; // Exit the loop after copying the token
-
-                } else {
-                    Logger::logger().error("No token found in email."); // Log error if no token is found
-                }
+            std::optional<std::string> token = get_token(handler, uid, sender.address, *profile); // Get the token from the email
+            if(token.has_value() && token_cache.lookup(TokenCache::token_key(token.value(), sender.address)).has_value()) {
+                Logger::logger().info("Token was already delivered."); // Same token seen in another email or mailbox
+            } else if(token.has_value()) {
+                token_cache.insert(TokenCache::token_key(token.value(), sender.address)); // Never deliver this token again
+                // Time from the start of the poll cycle until the token was extracted
+                auto time_to_token = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - cycle_start);
+                metrics::counter("daemon.time_to_token_ms").set(time_to_token.count());
+                metrics::counter("daemon.tokens_found").add();
+                scheduler.record_latency(std::max(0L, static_cast<long>(std::difftime(std::time(nullptr), email_time) * 1000))); // Time from arrival to detection, 0 if the server clock is ahead
+
+                token_cache.insert(key, "delete"); // Processed, never fetch it again
+                deliver_token({sender.address, mailbox, token.value(), email_time, 0}); // Copied to the clipboard by the delivery thread
+                control::on_token(sender.address); // Back to the low-cost mode if this was the awaited token
+                break; // Exit the loop after delivering the token
+
             } else {
-                Logger::logger().info("Email is not recent."); // Log if the email is not recent
+                Logger::logger().error("No token found in email."); // Log error if no token is found
             }
-
-            uids_copy.pop_back(); // Remove the processed UID from the vector
         }
 
-        if(!uids.empty()) {
-            handler->delete_uids(uids); // Delete the processed emails
-            Logger::logger().warning("Deleted processed emails."); // Log deletion of processed emails
-        }
-        
-        Logger::logger().debug("Waiting for " + std::to_string(POLLING_INTERVAL / 1000) + " seconds before checking again..."); // Log the wait time
-        Sleep(POLLING_INTERVAL); // Wait for the polling interval before checking again
+        token_cache.insert(key, "delete"); // Processed, never fetch it again
+        uids_copy.pop_back(); // Remove the processed UID from the vector
+    }
+
+    if(!uids.empty()) {
+        handler.queue_delete(uids); // Delete the processed emails with the next request
+        Logger::logger().warning("Queued processed emails for deletion."); // Log deletion of processed emails
     }
+
+    alloc_profiler::end_cycle(); // Close the cycle for the allocation statistics
+    return found;
 }
 
-void init() {
+// Creates a handler for the named watcher and retries until it is initialized
+std::unique_ptr<IMAPHandler> create_handler(const std::string& name) {
     bool verbose = false; // Set verbose mode to false
 
     // Set verbose mode based on DEBUG_ACTIVATE
@@ -164,18 +319,310 @@ void init() {
         verbose = true; // Set verbose mode to true if DEBUG is activated
     #endif
 
-    handler = new IMAPHandler(IMAP_SERVER, std::to_string(IMAP_PORT), IMAP_USERNAME, IMAP_PASSWORD, 36000L, verbose); // Initialize the IMAP handler
-    while(true) {
+    auto handler = std::make_unique<IMAPHandler>(IMAP_SERVER, std::to_string(IMAP_PORT), IMAP_USERNAME, IMAP_PASSWORD, IMAP_STALL_TIMEOUT, verbose); // Initialize the IMAP handler
+    handler->set_deadlines({IMAP_CONNECT_TIMEOUT, IMAP_SEARCH_TIMEOUT, IMAP_FETCH_TIMEOUT, IMAP_STORE_TIMEOUT, IMAP_COMMAND_TIMEOUT});
+    handler->set_cancel_token(cancel_token); // Shutdown and reload abort hanging operations
+    handler->set_compression(IMAP_COMPRESS); // Enable compression if configured
+    handler->set_native(IMAP_NATIVE); // Pipeline commands over the raw connection if configured
+
+    // Every watcher records to (or replays from) its own transcript
+    std::string transcript_suffix = "." + name;
+    std::replace(transcript_suffix.begin(), transcript_suffix.end(), '/', '_');
+    if (std::string(IMAP_REPLAY_FILE) != "") {
+        handler->set_replay(IMAP_REPLAY_FILE + transcript_suffix);
+    } else if (std::string(IMAP_CAPTURE_FILE) != "") {
+        handler->set_capture(IMAP_CAPTURE_FILE + transcript_suffix);
+    }
+    while(!os::shutdown_requested()) {
         try {
             handler->initialize(); // Initialize the connection
             break; // Break the loop if connection is successful
         } catch (const std::exception& e) {
             Logger::logger().error("Initialization failed: " + std::string(e.what())); // Log connection failure
-            Sleep(1000); // Wait before retrying
+            os::wait(1000); // Wait before retrying
+        }
+    }
+
+    Logger::logger().info("IMAP handler initialized."); // Log the initialization of the IMAP handler
+    return handler;
+}
+
+// Connects a new session and selects the mailbox (if given), throws on failure
+std::unique_ptr<IMAPHandler> open_session(const std::string& name, const std::string& mailbox) {
+    std::unique_ptr<IMAPHandler> handler = create_handler(name);
+    handler->connect(); // Connect to the IMAP server
+    Logger::logger().info("Connected to IMAP server."); // Log connection to the server
+
+    if (!mailbox.empty()) {
+        handler->select(mailbox); // Select the watched mailbox
+        Logger::logger().info("Selected " + mailbox + "."); // Log selection of the mailbox
+    }
+    return handler;
+}
+
+// True while sessions are recorded or replayed, extra commands depending on timing would break the replay
+bool transcript_active() {
+    return std::string(IMAP_CAPTURE_FILE) != "" || std::string(IMAP_REPLAY_FILE) != "";
+}
+
+// Keeps a logged-in spare session, so a dead session is replaced without connect, login and SELECT.
+// Opened and probed every IMAP_STANDBY_KEEPALIVE seconds, never while capturing or replaying.
+void keep_standby(std::unique_ptr<IMAPHandler>& standby, const std::string& name, const std::string& mailbox, std::chrono::steady_clock::time_point& last_keepalive) {
+    if (!IMAP_STANDBY || transcript_active()) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_keepalive < std::chrono::seconds(IMAP_STANDBY_KEEPALIVE)) {
+        return;
+    }
+    last_keepalive = now;
+
+    try {
+        if (standby) {
+            if (!standby->probe(IMAP_PROBE_TIMEOUT)) { // Also keeps the server and NATs from dropping the idle session
+                standby.reset(); // Dead, opened again after the next keepalive interval
+            }
+        } else {
+            standby = open_session(name, mailbox);
+            Logger::logger().info("Standby connection ready for " + name + ".");
+        }
+    } catch (const std::exception& e) {
+        Logger::logger().warning("Standby connection for " + name + " failed: " + std::string(e.what()));
+        standby.reset(); // Retried after the next keepalive interval
+    }
+}
+
+// Takes over the standby session if there is one, otherwise opens a new one
+std::unique_ptr<IMAPHandler> take_session(std::unique_ptr<IMAPHandler>& standby, const std::string& name, const std::string& mailbox) {
+    if (!standby) {
+        return open_session(name, mailbox);
+    }
+    Logger::logger().info("Failing over " + name + " to the standby connection."); // Log the failover
+    metrics::counter("imap.failovers").add();
+    return std::move(standby);
+}
+
+// Waits for the polling interval and probes the idle session every IMAP_PROBE_INTERVAL seconds.
+// Returns false as soon as a probe is late, so the session is replaced before the next poll needs it.
+// Sets woken if another thread ended the wait early (e.g. the arm command).
+bool wait_probing(IMAPHandler& handler, long interval, bool& woken) {
+    woken = false;
+    if (IMAP_PROBE_INTERVAL <= 0 || transcript_active()) {
+        woken = os::wait(interval) == os::WAIT_WAKE;
+        return true;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(interval);
+    while (!os::shutdown_requested()) {
+        auto now = std::chrono::steady_clock::now();
+        auto next_probe = now + std::chrono::seconds(IMAP_PROBE_INTERVAL);
+        if (next_probe >= deadline) {
+            woken = os::wait(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) == os::WAIT_WAKE;
+            return true;
+        }
+        os::WaitResult result = os::wait(IMAP_PROBE_INTERVAL * 1000L);
+        if (result != os::WAIT_TIMEOUT) {
+            woken = result == os::WAIT_WAKE;
+            return true; // Woken up, poll right away
         }
+        if (!handler.probe(IMAP_PROBE_TIMEOUT)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Interval until the next poll, shortened while the daemon is armed
+long poll_interval(PollScheduler& scheduler) {
+    long interval = scheduler.next_interval(); // Get the adaptive polling interval
+    return control::armed() ? std::min<long>(interval, ARM_POLLING_INTERVAL) : interval;
+}
+
+// Publishes the scheduler statistics of a watcher every METRICS_INTERVAL seconds
+void report_scheduler(PollScheduler& scheduler, const std::string& mailbox, std::chrono::steady_clock::time_point& last_report) {
+    if (std::chrono::steady_clock::now() - last_report >= std::chrono::seconds(METRICS_INTERVAL)) {
+        scheduler.report(mailbox); // Publish the scheduler statistics
+        last_report = std::chrono::steady_clock::now();
     }
+}
+
+// Watches a single mailbox on its own connection, run by the worker pool one step at a time.
+// A step polls when the interval has passed (or after a wake) and otherwise probes the idle session.
+class MailboxWatch : public WorkerPool::Job {
+private:
+    using clock = std::chrono::steady_clock;
+
+    std::string mailbox;
+    PollScheduler scheduler; // Adaptive polling interval
+    clock::time_point last_report; // Time of the last metric report
+    std::unique_ptr<IMAPHandler> handler; // Session selected on the mailbox, null until connected
+    std::unique_ptr<IMAPHandler> standby; // Spare session selected on the same mailbox
+    clock::time_point last_keepalive; // Time of the last standby keepalive (epoch: open right away)
+    clock::time_point next_poll; // Time of the next poll (epoch: poll right away)
+
+public:
+    explicit MailboxWatch(const std::string& mailbox)
+        : mailbox(mailbox), scheduler(POLLING_INTERVAL_MIN, POLLING_INTERVAL_MAX, POLLING_BACKOFF, POLLING_JITTER, POLLING_HOT_WINDOW), last_report(clock::now()) {
+    }
+
+    long step(bool woken) override {
+        try {
+            if (!handler) {
+                handler = take_session(standby, mailbox, mailbox); // Connect and select, or take over the standby
+            }
+
+            if (woken) {
+                scheduler.on_activity(); // Woken by the arm command or a reload, a token may follow soon
+            }
+            if (woken || clock::now() >= next_poll) {
+                poll_mailbox(*handler, scheduler, mailbox); // Check for new emails
+                report_scheduler(scheduler, mailbox, last_report);
+                keep_standby(standby, mailbox + ".standby", mailbox, last_keepalive);
+
+                long interval = poll_interval(scheduler);
+                Logger::logger().debug("Waiting for " + std::to_string(interval) + " milliseconds before checking " + mailbox + " again..."); // Log the wait time
+                next_poll = clock::now() + std::chrono::milliseconds(interval);
+            } else if (!handler->probe(IMAP_PROBE_TIMEOUT)) {
+                Logger::logger().warning("Connection for " + mailbox + " is not responding, replacing it."); // Log the stale session
+                metrics::counter("imap.probe_reconnects").add();
+                handler = take_session(standby, mailbox, mailbox); // Rebuilt while idle, the next poll does not stall
+            }
+        }
+        catch (const std::exception& e) {
+            Logger::logger().error("Error in " + mailbox + ": " + std::string(e.what())); // Log any errors that occur
+            handler.reset();
+            return standby ? 0 : 1000; // Wait before reconnecting, a standby is taken over right away
+        }
+        catch (...) {
+            Logger::logger().error("Unknown error occurred in " + mailbox + "."); // Log unknown errors
+            handler.reset();
+            return standby ? 0 : 1000;
+        }
+
+        // Probe the idle session every IMAP_PROBE_INTERVAL seconds, so it is replaced before the next poll needs it
+        long until_poll = std::max(0L, static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(next_poll - clock::now()).count()));
+        if (IMAP_PROBE_INTERVAL > 0 && !transcript_active()) {
+            return std::min(until_poll, IMAP_PROBE_INTERVAL * 1000L);
+        }
+        return until_poll;
+    }
+};
+
+// Watches every mailbox on its own connection, sharded over WORKER_THREADS threads
+void watch_pool(const std::vector<std::string>& mailboxes) {
+    size_t threads = WORKER_THREADS > 0 ? WORKER_THREADS : std::min<size_t>(mailboxes.size(), std::max(1u, std::thread::hardware_concurrency()));
+    WorkerPool pool(threads);
+    for (const std::string& mailbox : mailboxes) {
+        pool.add(std::make_unique<MailboxWatch>(mailbox));
+    }
+    pool.run(); // Until shutdown
+}
+
+// Extracts the mailbox names of STATUS responses sent by NOTIFY (RFC 5465)
+std::set<std::string> parse_status_mailboxes(const std::string& data) {
+    std::set<std::string> mailboxes;
+    std::istringstream stream(data);
+    std::string line;
+
+    while (std::getline(stream, line)) {
+        if (!line.starts_with("* STATUS ")) {
+            continue; // Not a mailbox event
+        }
+
+        std::string name = line.substr(9); // Skip "* STATUS "
+        if (name.starts_with("\"")) {
+            name = name.substr(1, name.find('"', 1) - 1); // Quoted mailbox name
+        } else {
+            name = name.substr(0, name.find(' ')); // Atom mailbox name
+        }
+        mailboxes.insert(name);
+    }
+    return mailboxes;
+}
+
+// Watches all mailboxes on a single connection using NOTIFY (RFC 5465).
+// Returns false if the server does not support NOTIFY, true on shutdown.
+bool watch_notify(const std::vector<std::string>& mailboxes) {
+    const std::string& home = mailboxes.front(); // Mailbox that stays selected between events
+    PollScheduler scheduler(POLLING_INTERVAL_MIN, POLLING_INTERVAL_MAX, POLLING_BACKOFF, POLLING_JITTER, POLLING_HOT_WINDOW); // Adaptive polling interval
+    auto last_report = std::chrono::steady_clock::now(); // Time of the last metric report
+    std::unique_ptr<IMAPHandler> standby; // Spare session, NOTIFY is set up again after a failover
+    std::chrono::steady_clock::time_point last_keepalive; // Time of the last standby keepalive (epoch: open right away)
+
+    while(!os::shutdown_requested()) {
+        std::unique_ptr<IMAPHandler> handler;
+
+        try {
+            handler = take_session(standby, "notify", ""); // Connect, or take over the standby
+
+            if (!handler->get_fast_paths().notify) { // Negotiated on connect
+                Logger::logger().info("Server does not support NOTIFY."); // Log the missing extension
+                return false;
+            }
+
+            // Catch up on every mailbox once, then wait for events
+            for (auto it = mailboxes.rbegin(); it != mailboxes.rend(); it++) {
+                handler->select(*it); // The home mailbox is selected last and stays selected
+                poll_mailbox(*handler, scheduler, *it);
+            }
 
-    os::init();
+            // Subscribe to new messages in all mailboxes
+            std::string watched;
+            for (size_t i = 1; i < mailboxes.size(); i++) {
+                watched += (i > 1 ? " \"" : "\"") + mailboxes[i] + "\"";
+            }
+            std::string cmd = "NOTIFY SET (selected (MessageNew MessageExpunge))";
+            if (!watched.empty()) {
+                cmd += " (mailboxes (" + watched + ") (MessageNew))";
+            }
+            handler->perform_custom_request(cmd);
+            Logger::logger().info("Watching " + std::to_string(mailboxes.size()) + " mailboxes with NOTIFY."); // Log the NOTIFY mode
+
+            bool woken = false; // The last wait was ended by another thread
+            while(!os::shutdown_requested()) {
+                // A single round trip collects the events of all mailboxes
+                Response res = handler->perform_custom_request("NOOP");
+                std::set<std::string> changed = parse_status_mailboxes(res.data);
+                bool home_changed = res.data.find(" EXISTS") != std::string::npos;
+                if (woken || home_changed || !changed.empty()) {
+                    scheduler.on_activity(); // Armed or new mail from any sender, more may follow soon
+                }
+
+                if (home_changed) {
+                    poll_mailbox(*handler, scheduler, home); // New mail in the selected mailbox
+                }
+                for (const std::string& mailbox : changed) {
+                    handler->select(mailbox); // Switch only to mailboxes with new mail
+                    poll_mailbox(*handler, scheduler, mailbox);
+                }
+                if (!changed.empty()) {
+                    handler->select(home); // Return to the home mailbox
+                }
+                if (!home_changed && changed.empty()) {
+                    scheduler.on_poll(false); // Nothing happened, let the scheduler back off
+                }
+                report_scheduler(scheduler, "notify", last_report);
+                keep_standby(standby, "notify.standby", "", last_keepalive);
+
+                long interval = poll_interval(scheduler);
+                Logger::logger().debug("Waiting for " + std::to_string(interval) + " milliseconds before checking for events again..."); // Log the wait time
+                if (!wait_probing(*handler, interval, woken)) { // Wait for the polling interval, a wake checks right away
+                    throw std::runtime_error("Connection is not responding."); // NOTIFY is set up again on the new session
+                }
+            }
+        }
+        catch (const std::exception& e) {
+            Logger::logger().error("Error: " + std::string(e.what())); // Log any errors that occur
+        }
+        catch (...) {
+            Logger::logger().error("Unknown error occurred."); // Log unknown errors
+        }
+
+        if (!standby) {
+            os::wait(1000); // Wait before reconnecting, a standby is taken over right away
+        }
+    }
+    return true;
 }
 
 int run(){
@@ -187,7 +634,7 @@ int run(){
     #endif
 
     // Set env variable for timezone
-    _putenv("TZ=UTC"); // Set the timezone to UTC
+    os::set_env("TZ", "UTC"); // Set the timezone to UTC
 
     Logger::logger().info("Starting daemon..."); // Log the start of the daemon
     Logger::logger().info("IMAP_SERVER: " + std::string(IMAP_SERVER)); // Log the IMAP server
@@ -201,28 +648,87 @@ int run(){
     strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
     Logger::logger().info("Current UTC time: " + std::string(buffer));
 
-    // Running the main loop in a try-catch block to handle exceptions
-    while(true) {
-        init(); // Initialize the IMAP handler
-        Logger::logger().info("IMAP handler initialized."); // Log the initialization of the IMAP handler
+    if (!os::init()) { // Before the watchers start, so signals reach only the metrics loop
+        Logger::logger().error("Failed to initialize the platform layer.");
+        return 1;
+    }
 
+    if (!std::string(HISTORY_FILE_PATH).empty()) {
         try {
-            main_loop(); // Enter the main loop
+            token_history = std::make_unique<TokenHistory>(HISTORY_FILE_PATH, std::chrono::milliseconds(HISTORY_SYNC_DELAY));
+        } catch (const std::exception& e) {
+            Logger::logger().error("Token history disabled: " + std::string(e.what())); // Tokens are still delivered
         }
+    }
 
-        catch (const std::exception& e) {
-            Logger::logger().error("Error: " + std::string(e.what())); // Log any errors that occur
+    std::thread delivery(deliver_tokens); // Clipboard and history, off the watcher threads
+
+    const std::vector<std::string> mailboxes = MAILBOXES; // Mailboxes to watch
+    std::vector<std::thread> watchers;
+
+    if (mailboxes.size() > 1 && IMAP_USE_NOTIFY) {
+        // One connection for all mailboxes, falls back to the pool if NOTIFY is missing
+        watchers.emplace_back([mailboxes]() {
+            if (!watch_notify(mailboxes)) {
+                watch_pool(mailboxes); // One connection per mailbox
+            }
+        });
+    } else {
+        watchers.emplace_back(watch_pool, mailboxes); // One connection per mailbox
+    }
+
+    // Answer "arm" and friends until shutdown
+    std::thread control_server;
+    if (!std::string(CONTROL_SOCKET_PATH).empty()) {
+        control_server = std::thread([]() {
+            os::serve_local(CONTROL_SOCKET_PATH, [](const std::string& request) {
+                return control::handle(request, token_history.get());
+            });
+        });
+    }
+
+    // Handle signals and report metrics periodically while the watchers are running
+    auto last_report = std::chrono::steady_clock::now(); // Time of the last metric report
+    while(!os::shutdown_requested()) {
+        auto next_report = last_report + std::chrono::seconds(METRICS_INTERVAL);
+        long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(next_report - std::chrono::steady_clock::now()).count();
+        os::WaitResult result = os::wait(remaining, true); // Sleeps until the next report or a signal
+
+        if (result == os::WAIT_REPORT) {
+            // Report (and dump the trace) on request (SIGUSR1, or Ctrl+Break on Windows)
+            metrics::report();
+            alloc_profiler::report();
+            if (PERF_PROFILING) {
+                Logger::logger().info(perf_profiler::report()); // Counters of the running or last profiling session
+            }
+            trace::dump(TRACE_FILE_PATH); // Export the recent spans for Perfetto
+        } else if (result == os::WAIT_RELOAD) {
+            Logger::logger().info("Reload requested, checking all mailboxes now."); // Settings are compiled in
+            cancel_token->cancel(); // Sessions stuck in an operation reconnect
+            os::wake_all();
         }
-        catch (...) {
-            Logger::logger().error("Unknown error occurred."); // Log unknown errors
+        if (std::chrono::steady_clock::now() >= next_report) {
+            metrics::report();
+            last_report = std::chrono::steady_clock::now();
         }
+    }
 
-        Sleep(1000); // Wait before retrying the main loop
+    Logger::logger().info("Shutting down..."); // Watchers stop at their next wait
+    cancel_token->close(); // Do not wait for running operations to time out
 
-        // Resetting handler
-        delete handler;
+    for (std::thread& thread : watchers) {
+        thread.join();
     }
-
-    delete handler; // Clean up the IMAP handler
+    if (control_server.joinable()) {
+        control_server.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(delivery_mutex);
+        delivery_stopping = true; // Restores a clipboard that is still waiting for the paste
+    }
+    delivery_cv.notify_all();
+    delivery.join();
+    token_history.reset(); // Sync the last appends
+    alloc_profiler::report(); // Final allocation profile, while the logger is still alive
     return 0; // Return success
 }
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "extraction.hpp"
+#include "alloc_profiler.hpp"
+#include "perf_profiler.hpp"
+
+#include <bit>
+
+namespace {
+    constexpr size_t MARKUP_OVERLAP = 1024; // Scanned bytes kept for the next search, a markup match is assumed to be shorter
+}
+
+std::optional<std::string> extract_token(const ExtractionProfile& profile, const std::string& body, bool html, bool complete) {
+    TokenScanner scanner(profile, html);
+    scanner.feed(body);
+    return complete ? scanner.finish() : scanner.confirmed(); // An unhinted match may be beaten by a later range
+}
+
+TokenScanner::TokenScanner(const ExtractionProfile& profile, bool html) : profile(profile), normalizer(html) {
+}
+
+bool TokenScanner::feed(std::string_view text) {
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_EXTRACT); // Attribute allocations to extraction
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_EXTRACT); // Attribute CPU time as well
+
+    if (profile.markup) {
+        raw.append(text);
+        size_t end = raw.find_last_of(">\n"); // A token never spans a tag or line, so the unfinished rest is left out
+        return end != std::string::npos && scan_raw(end + 1);
+    }
+
+    normalizer.feed(text);
+    scan_runs();
+    return confirmed().has_value();
+}
+
+std::optional<std::string> TokenScanner::finish() {
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_EXTRACT); // Attribute allocations to extraction
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_EXTRACT); // Attribute CPU time as well
+
+    if (profile.markup) {
+        scan_raw(raw.size());
+        return best;
+    }
+    normalizer.finish();
+    scan_runs();
+    return best;
+}
+
+std::optional<std::string> TokenScanner::confirmed() const {
+    if (profile.markup || best_score > 0) {
+        return best;
+    }
+    return std::nullopt; // No token, or only an unhinted match that a later one may beat
+}
+
+// Rank the matches in the text by their hints, the first one wins a tie
+void TokenScanner::scan_runs() {
+    for (const html::TextRun& run : normalizer.take_runs()) {
+        std::optional<std::string_view> token;
+        std::smatch match;
+        if (profile.matcher) {
+            token = profile.matcher(run.text, marker_seen);
+        } else if (std::regex_search(run.text, match, profile.pattern)) {
+            token = std::string_view(run.text).substr(match.position(1), match.length(1));
+        }
+        if (!token) {
+            continue;
+        }
+        int score = std::popcount(run.hints);
+        if (score > best_score) {
+            best = std::string(*token);
+            best_score = score;
+        }
+    }
+}
+
+bool TokenScanner::scan_raw(size_t end) {
+    if (best.has_value()) {
+        return true; // The first match of a markup pattern wins
+    }
+    std::match_results<std::string::const_iterator> match;
+    if (std::regex_search(raw.cbegin(), raw.cbegin() + end, match, profile.pattern)) {
+        best = match.str(1); // Return the first capture group
+        raw.clear();
+        return true;
+    }
+
+    // Drop the scanned text up to a tag or line boundary, only a match reaching into the next chunk needs it
+    if (end > MARKUP_OVERLAP) {
+        size_t cut = raw.find_last_of(">\n", end - MARKUP_OVERLAP);
+        if (cut != std::string::npos) {
+            raw.erase(0, cut + 1);
+        }
+    }
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "header_filter.hpp"
+#include "mime.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Seconds the INTERNALDATE may be ahead of our clock, a server with a clock a little fast still delivers fresh mail
+static constexpr double MAX_CLOCK_SKEW = 30;
+
+// Lowercase copy of a string
+static std::string to_lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+    return value;
+}
+
+MessageHeaders MessageHeaders::parse(const std::string& fields, const std::string& internaldate) {
+    MessageHeaders headers;
+    headers.from = mime::header_value(fields, "From");
+    headers.subject = mime::decode_header_words(mime::header_value(fields, "Subject"));
+
+    std::string content_type = to_lower(mime::header_value(fields, "Content-Type"));
+    headers.content_type = content_type.substr(0, content_type.find_first_of("; "));
+    if (headers.content_type.empty()) {
+        headers.content_type = "text/plain"; // Default of RFC 2045
+    }
+
+    headers.received = parse_internaldate(internaldate);
+    return headers;
+}
+
+// Constructor
+HeaderFilter::HeaderFilter(const std::vector<std::string>& required, const std::vector<std::string>& ignored, long max_age) : max_age(max_age) {
+    for (const std::string& pattern : required) {
+        this->required.push_back(to_lower(pattern));
+    }
+    for (const std::string& pattern : ignored) {
+        this->ignored.push_back(to_lower(pattern));
+    }
+}
+
+std::optional<std::string> HeaderFilter::reject(const MessageHeaders& headers, std::time_t now) const {
+    // Same window as the former per-email INTERNALDATE check
+    if (headers.received == 0) {
+        return "no arrival time";
+    }
+    double age = std::difftime(now, headers.received);
+    if (age < -MAX_CLOCK_SKEW) {
+        return "arrival time in the future";
+    }
+    if (age > max_age) {
+        return "not recent";
+    }
+
+    // Attachments, calendar invites and the like carry no text to search
+    if (!headers.content_type.starts_with("text/") && !headers.content_type.starts_with("multipart/")) {
+        return "content type " + headers.content_type;
+    }
+
+    std::string subject = to_lower(headers.subject);
+    for (const std::string& pattern : ignored) {
+        if (subject.find(pattern) != std::string::npos) {
+            return "subject contains \"" + pattern + "\"";
+        }
+    }
+    if (!required.empty() && std::none_of(required.begin(), required.end(), [&](const std::string& pattern) { return subject.find(pattern) != std::string::npos; })) {
+        return "subject does not match";
+    }
+    return std::nullopt;
+}
+
+std::time_t parse_internaldate(const std::string& date) {
+    static const char* months[] = {"jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec"};
+
+    int day, year, hour, minute, second, zone;
+    char month_name[4] = {};
+    if (std::sscanf(date.c_str(), " %d-%3s-%d %d:%d:%d %d", &day, month_name, &year, &hour, &minute, &second, &zone) != 7) {
+        return 0;
+    }
+    auto month = std::find_if(std::begin(months), std::end(months), [&](const char* name) { return to_lower(month_name) == name; });
+    if (month == std::end(months)) {
+        return 0;
+    }
+
+    // Days since the epoch without going through the local time zone
+    std::chrono::year_month_day ymd{std::chrono::year(year), std::chrono::month(static_cast<unsigned>(month - std::begin(months) + 1)), std::chrono::day(static_cast<unsigned>(day))};
+    if (!ymd.ok()) {
+        return 0;
+    }
+    long long seconds = std::chrono::sys_days(ymd).time_since_epoch().count() * 86400LL + hour * 3600 + minute * 60 + second;
+    int sign = zone < 0 ? -1 : 1;
+    seconds -= sign * ((std::abs(zone) / 100) * 3600 + (std::abs(zone) % 100) * 60); // Back to UTC
+    return static_cast<std::time_t>(seconds);
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "history.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace {
+    const char MAGIC[8] = {'T', 'K', 'H', 'I', 'S', 'T', '0', '1'};
+    const uint64_t GROWTH = 256; // Records added to the file when it is full
+
+    // Fixed header at the start of the file
+    struct Header {
+        char magic[8];
+        uint32_t record_size;
+        uint32_t reserved;
+        uint64_t count; // Written after the record, a record beyond it was never complete
+        char padding[40];
+    };
+    static_assert(sizeof(Header) == 64, "The header layout is part of the file format");
+
+    // Copies a string into a fixed field, truncated and NUL padded
+    void store(char* field, size_t size, const std::string& value) {
+        size_t length = std::min(value.size(), size - 1);
+        std::memcpy(field, value.data(), length);
+        std::memset(field + length, 0, size - length);
+    }
+
+    std::string load(const char* field, size_t size) {
+        return std::string(field, strnlen(field, size));
+    }
+}
+
+// Constructor
+TokenHistory::TokenHistory(const std::string& path, std::chrono::milliseconds sync_delay) : file(path), sync_delay(sync_delay) {
+    if (file.size() == 0) {
+        file.resize(sizeof(Header) + GROWTH * sizeof(Record));
+        Header* header = reinterpret_cast<Header*>(file.data());
+        std::memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->record_size = sizeof(Record);
+        file.sync();
+    }
+
+    Header* header = reinterpret_cast<Header*>(file.data());
+    if (file.size() < sizeof(Header) || std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->record_size != sizeof(Record)) {
+        throw std::runtime_error("Not a token history file: " + path);
+    }
+    count = std::min<uint64_t>(header->count, (file.size() - sizeof(Header)) / sizeof(Record));
+
+    // Rebuild the index, the file is the only copy
+    for (uint64_t i = 0; i < count; i++) {
+        const Record* r = record(i);
+        by_sender.emplace(std::make_pair(load(r->sender, sizeof(r->sender)), r->received), i);
+        by_time.emplace(r->received, i);
+    }
+    Logger::logger().info("Token history loaded with " + std::to_string(count) + " entries.");
+
+    syncer = std::thread(&TokenHistory::sync_loop, this);
+}
+
+TokenHistory::~TokenHistory() {
+    {
+        std::lock_guard<std::mutex> lock(sync_mutex);
+        stopping = true;
+    }
+    sync_cv.notify_one();
+    syncer.join(); // Syncs what is left before it returns
+}
+
+TokenHistory::Record* TokenHistory::record(uint64_t number) const {
+    return reinterpret_cast<Record*>(file.data() + sizeof(Header)) + number;
+}
+
+HistoryEntry TokenHistory::entry(uint64_t number) const {
+    const Record* r = record(number);
+    HistoryEntry e;
+    e.sender = load(r->sender, sizeof(r->sender));
+    e.mailbox = load(r->mailbox, sizeof(r->mailbox));
+    e.token = load(r->token, sizeof(r->token));
+    e.received = static_cast<std::time_t>(r->received);
+    e.delivered = static_cast<std::time_t>(r->delivered);
+    return e;
+}
+
+void TokenHistory::append(const HistoryEntry& e) {
+    {
+        std::lock_guard<std::mutex> lock(history_mutex);
+        if (sizeof(Header) + (count + 1) * sizeof(Record) > file.size()) {
+            std::lock_guard<std::mutex> resize_lock(resize_mutex); // Rare, waits for a running sync
+            file.resize(file.size() + GROWTH * sizeof(Record));
+        }
+
+        Record* r = record(count);
+        r->received = e.received;
+        r->delivered = e.delivered;
+        store(r->sender, sizeof(r->sender), e.sender);
+        store(r->mailbox, sizeof(r->mailbox), e.mailbox);
+        store(r->token, sizeof(r->token), e.token);
+        reinterpret_cast<Header*>(file.data())->count = count + 1; // Publish the record
+
+        by_sender.emplace(std::make_pair(e.sender, static_cast<int64_t>(e.received)), count);
+        by_time.emplace(e.received, count);
+        count++;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sync_mutex);
+        dirty = true;
+    }
+    sync_cv.notify_one();
+    metrics::counter("history.appends").add();
+}
+
+std::optional<HistoryEntry> TokenHistory::last(const std::string& sender) const {
+    std::lock_guard<std::mutex> lock(history_mutex);
+    auto it = by_sender.upper_bound(std::make_pair(sender, std::numeric_limits<int64_t>::max()));
+    if (it == by_sender.begin() || std::prev(it)->first.first != sender) {
+        return std::nullopt;
+    }
+    return entry(std::prev(it)->second);
+}
+
+std::vector<HistoryEntry> TokenHistory::between(std::time_t from, std::time_t to) const {
+    std::lock_guard<std::mutex> lock(history_mutex);
+    std::vector<HistoryEntry> entries;
+    for (auto it = by_time.lower_bound(from); it != by_time.end() && it->first <= to; ++it) {
+        entries.push_back(entry(it->second));
+    }
+    return entries;
+}
+
+uint64_t TokenHistory::size() const {
+    std::lock_guard<std::mutex> lock(history_mutex);
+    return count;
+}
+
+// Waits for appends and syncs them in groups
+void TokenHistory::sync_loop() {
+    std::unique_lock<std::mutex> lock(sync_mutex);
+    while (true) {
+        sync_cv.wait(lock, [this] { return dirty || stopping; });
+        if (!stopping) {
+            sync_cv.wait_for(lock, sync_delay, [this] { return stopping; }); // Let more appends join this sync
+        }
+        bool sync = dirty;
+        bool stop = stopping;
+        dirty = false;
+        lock.unlock(); // Appends go on while the disk is busy
+
+        if (sync) {
+            std::lock_guard<std::mutex> resize_lock(resize_mutex);
+            auto start = std::chrono::steady_clock::now();
+            if (!file.sync()) {
+                Logger::logger().error("Failed to sync the token history.");
+            }
+            metrics::counter("history.sync_us").set(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+        if (stop) {
+            return;
+        }
+        lock.lock();
+    }
+}
\ No newline at end of file
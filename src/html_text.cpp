@@ -0,0 +1,453 @@
+#include "html_text.hpp"
+#include "utils.hpp"
+
+#include <array>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+
+namespace {
+    constexpr size_t MAX_TAG = 4096; // Longer tags are truncated, only the name and the style are needed
+    constexpr size_t MAX_ENTITY = 12; // Longer "entities" are plain text
+    constexpr size_t MAX_DEPTH = 256; // Deeper nesting is treated as flat, bounds memory on broken markup
+    constexpr size_t NEAR_CODE_DISTANCE = 48; // Characters after "code" that still count as close
+
+    // Elements that start a new line, their text never continues a neighbouring run
+    constexpr std::array<std::string_view, 27> BLOCK_ELEMENTS = {
+        "address", "article", "blockquote", "br", "center", "dd", "div", "dt", "footer",
+        "form", "h1", "h2", "h3", "h4", "h5", "h6", "header", "hr", "li", "ol", "p",
+        "pre", "section", "table", "td", "th", "tr"
+    };
+
+    // Elements without content or end tag
+    constexpr std::array<std::string_view, 11> VOID_ELEMENTS = {
+        "area", "base", "br", "col", "hr", "img", "input", "link", "meta", "source", "wbr"
+    };
+
+    // Character classes of the text loop, one table lookup per character
+    constexpr unsigned char CLASS_SPACE = 1;
+    constexpr unsigned char CLASS_MARKUP = 2; // Starts a tag or an entity
+    constexpr unsigned char CLASS_TAG = 3; // Ends a tag or starts a quoted attribute
+    constexpr std::array<unsigned char, 256> CHAR_CLASS = []() {
+        std::array<unsigned char, 256> table{};
+        for (unsigned char c : {' ', '\t', '\n', '\r', '\f'}) {
+            table[c] = CLASS_SPACE;
+        }
+        table['<'] = CLASS_MARKUP;
+        table['&'] = CLASS_MARKUP;
+        table['>'] = CLASS_TAG;
+        table['"'] = CLASS_TAG;
+        table['\''] = CLASS_TAG;
+        return table;
+    }();
+
+    bool is_space(char c) {
+        return CHAR_CLASS[static_cast<unsigned char>(c)] == CLASS_SPACE;
+    }
+
+    char to_lower(char c) {
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+
+    bool is_alnum(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+    }
+
+    bool contains(const auto& list, std::string_view name) {
+        return std::find(list.begin(), list.end(), name) != list.end();
+    }
+
+    // Value of a CSS property in a lowercased tag, empty if missing
+    std::string_view css_value(std::string_view tag, std::string_view property) {
+        size_t pos = tag.find(property);
+        if (pos == std::string_view::npos) {
+            return {};
+        }
+        pos = tag.find(':', pos + property.size());
+        if (pos == std::string_view::npos) {
+            return {};
+        }
+        pos = tag.find_first_not_of(" \t", pos + 1);
+        if (pos == std::string_view::npos) {
+            return {};
+        }
+        return tag.substr(pos, tag.find_first_of(";\"'", pos) - pos);
+    }
+
+    bool is_bold_weight(std::string_view value) {
+        return value.starts_with("bold") || (!value.empty() && value[0] >= '6' && value[0] <= '9' && value.size() >= 3);
+    }
+
+    bool is_large_size(std::string_view value) {
+        if (value.starts_with("large") || value.starts_with("x-large") || value.starts_with("xx-large")) {
+            return true;
+        }
+        std::string number(value.substr(0, 16));
+        char* unit = nullptr;
+        double size = std::strtod(number.c_str(), &unit);
+        std::string_view suffix(unit);
+        if (suffix.starts_with("px")) return size >= 20;
+        if (suffix.starts_with("pt")) return size >= 15;
+        if (suffix.starts_with("em") || suffix.starts_with("rem")) return size >= 1.25;
+        if (suffix.starts_with("%")) return size >= 125;
+        return false;
+    }
+
+    // Hints an opening tag adds to its content
+    unsigned tag_hints(std::string_view name, std::string_view tag) {
+        unsigned hints = html::HINT_NONE;
+        if (name == "b" || name == "strong") {
+            hints |= html::HINT_BOLD;
+        }
+        if (name.size() == 2 && name[0] == 'h' && name[1] >= '1' && name[1] <= '6') {
+            hints |= html::HINT_BOLD;
+            if (name[1] <= '3') {
+                hints |= html::HINT_LARGE;
+            }
+        }
+        if (name == "big") {
+            hints |= html::HINT_LARGE;
+        }
+        if (name == "font") {
+            size_t pos = tag.find("size=");
+            if (pos != std::string_view::npos && pos + 5 < tag.size()) {
+                char size = tag[pos + 5] == '"' || tag[pos + 5] == '\'' ? tag[std::min(pos + 6, tag.size() - 1)] : tag[pos + 5];
+                if (size >= '5' && size <= '7') {
+                    hints |= html::HINT_LARGE;
+                }
+            }
+        }
+        if (tag.find("font-") != std::string_view::npos) {
+            if (is_bold_weight(css_value(tag, "font-weight"))) {
+                hints |= html::HINT_BOLD;
+            }
+            if (is_large_size(css_value(tag, "font-size"))) {
+                hints |= html::HINT_LARGE;
+            }
+        }
+        return hints;
+    }
+
+    // Position of the last "code" in the text (any case), npos if missing
+    size_t find_last_code(const std::string& text) {
+        for (size_t i = text.size(); i >= 4; i--) {
+            const char* p = text.data() + i - 4;
+            if ((p[0] | 0x20) == 'c' && (p[1] | 0x20) == 'o' && (p[2] | 0x20) == 'd' && (p[3] | 0x20) == 'e') {
+                return i - 4; // "| 0x20" lowercases ASCII letters, other bytes never match
+            }
+        }
+        return std::string::npos;
+    }
+}
+
+html::Normalizer::Normalizer(bool markup) : markup(markup), since_code(std::numeric_limits<size_t>::max()) {
+}
+
+void html::Normalizer::feed(std::string_view data) {
+    const char* p = data.data();
+    const char* end = p + data.size();
+
+    while (p < end) {
+        switch (state) {
+        case TEXT: {
+            if (!markup) {
+                // Every line is a run of its own, so a streamed plain text body yields runs before finish()
+                const void* newline = std::memchr(p, '\n', end - p);
+                const char* stop = newline ? static_cast<const char*>(newline) : end;
+                append(p, stop);
+                p = stop;
+                if (newline) {
+                    end_run();
+                    p++;
+                }
+                break;
+            }
+            // Copy up to the next tag or entity
+            const char* stop = p;
+            while (stop < end && CHAR_CLASS[static_cast<unsigned char>(*stop)] != CLASS_MARKUP) {
+                stop++;
+            }
+            if (skip.empty()) {
+                append(p, stop);
+            }
+            p = stop;
+            if (p == end) {
+                break;
+            }
+            if (*p == '<') {
+                state = TAG;
+                tag.clear();
+                quote = 0;
+            } else if (skip.empty()) {
+                state = ENTITY;
+                entity.clear();
+            }
+            p++;
+            break;
+        }
+        case TAG:
+            // The first characters decide between a tag, a comment and plain text
+            while (p < end && state == TAG && tag.size() < 3) {
+                char c = *p;
+                if (tag.empty() && !skip.empty() && c != '/') {
+                    state = TEXT; // Only an end tag can close style or script, e.g. "if (a<b)"
+                    break;
+                }
+                if (tag.empty() && !is_alnum(c) && c != '/' && c != '!' && c != '?') {
+                    state = TEXT; // Not a tag, e.g. "a < b"
+                    append('<');
+                    break;
+                }
+                p++;
+                if (c == '>') {
+                    state = TEXT;
+                    handle_tag();
+                    break;
+                }
+                if (c == '"' || c == '\'') {
+                    quote = c;
+                    tag.push_back(c);
+                    break; // Continue with the quote handling below
+                }
+                tag.push_back(c);
+                if (tag == "!--") {
+                    state = COMMENT;
+                    dashes = 0;
+                }
+            }
+            if (state != TAG) {
+                break;
+            }
+
+            // Copy up to the end of the tag, a '>' inside quotes does not end it
+            {
+                const char* stop = p;
+                while (stop < end) {
+                    if (quote) {
+                        const void* close = std::memchr(stop, quote, end - stop);
+                        stop = close ? static_cast<const char*>(close) + 1 : end;
+                        quote = close ? 0 : quote;
+                        continue;
+                    }
+                    while (stop < end && CHAR_CLASS[static_cast<unsigned char>(*stop)] != CLASS_TAG) {
+                        stop++;
+                    }
+                    if (stop == end || *stop == '>') {
+                        break;
+                    }
+                    quote = *stop++;
+                }
+                tag.append(p, std::min<size_t>(stop - p, MAX_TAG - std::min(tag.size(), MAX_TAG)));
+                p = stop;
+                if (p < end) {
+                    p++; // Skip the '>'
+                    state = TEXT;
+                    handle_tag();
+                }
+            }
+            break;
+        case COMMENT:
+            for (; p < end; p++) {
+                if (*p == '-') {
+                    dashes++;
+                } else if (*p == '>' && dashes >= 2) {
+                    p++;
+                    state = TEXT;
+                    break;
+                } else {
+                    dashes = 0;
+                }
+            }
+            break;
+        case ENTITY:
+            for (; p < end; p++) {
+                char c = *p;
+                if (c == ';') {
+                    p++;
+                    state = TEXT;
+                    handle_entity(true);
+                    break;
+                }
+                if ((!is_alnum(c) && c != '#') || entity.size() >= MAX_ENTITY) {
+                    state = TEXT; // Not an entity, the character is handled as text
+                    handle_entity(false);
+                    break;
+                }
+                entity.push_back(c);
+            }
+            break;
+        }
+    }
+}
+
+void html::Normalizer::finish() {
+    if (state == ENTITY) {
+        handle_entity(false);
+    }
+    state = TEXT;
+    end_run();
+}
+
+void html::Normalizer::append(char c) {
+    if (is_space(c)) {
+        pending_space = true;
+        return;
+    }
+    if (pending_space && !current.text.empty()) {
+        current.text.push_back(' ');
+    }
+    pending_space = false;
+    current.text.push_back(c);
+}
+
+void html::Normalizer::append(const char* begin, const char* end) {
+    // Collapse the whitespace straight into the run, locals keep the loop in registers
+    size_t size = current.text.size();
+    bool space = pending_space;
+    current.text.resize_and_overwrite(size + (end - begin) + 1, [begin, end, size, &space](char* buffer, size_t) {
+        char* out = buffer + size;
+        for (const char* in = begin; in < end; in++) {
+            char c = *in;
+            if (is_space(c)) {
+                space = true;
+                continue;
+            }
+            if (space && out != buffer) {
+                *out++ = ' ';
+            }
+            space = false;
+            *out++ = c;
+        }
+        return out - buffer;
+    });
+    pending_space = space;
+}
+
+void html::Normalizer::end_run() {
+    if (!current.text.empty()) {
+        if (since_code <= NEAR_CODE_DISTANCE) {
+            current.hints |= HINT_NEAR_CODE;
+        }
+        size_t pos = find_last_code(current.text);
+        if (pos != std::string::npos) {
+            current.hints |= HINT_NEAR_CODE;
+            since_code = current.text.size() - pos - 4;
+        } else if (since_code <= NEAR_CODE_DISTANCE) {
+            since_code += current.text.size(); // Saturates far above the distance
+        }
+        output.push_back(std::move(current));
+        current = TextRun();
+    }
+    current.hints = hints();
+    pending_space = false;
+}
+
+void html::Normalizer::handle_tag() {
+    if (tag.empty() || tag[0] == '!' || tag[0] == '?') {
+        return; // Doctype or processing instruction
+    }
+
+    bool closing = tag[0] == '/';
+    size_t start = closing ? 1 : 0;
+    size_t length = 0;
+    while (start + length < tag.size() && is_alnum(tag[start + length])) {
+        length++;
+    }
+    if (length == 0) {
+        return; // Not a tag, e.g. "a < b"
+    }
+    std::string name = tag.substr(start, length);
+    std::transform(name.begin(), name.end(), name.begin(), to_lower);
+    bool self_closing = tag.back() == '/';
+    bool block = contains(BLOCK_ELEMENTS, name);
+
+    // Inside style or script only the matching end tag matters
+    if (!skip.empty()) {
+        if (closing && name == skip) {
+            skip.clear();
+        }
+        return;
+    }
+    if (!closing && (name == "style" || name == "script")) {
+        if (!self_closing) {
+            skip = name;
+        }
+        return;
+    }
+
+    if (closing) {
+        for (size_t i = stack.size(); i-- > 0;) {
+            if (stack[i].first == name) {
+                stack.resize(i); // Also closes elements the sender left open
+                break;
+            }
+        }
+    } else if (!self_closing && !contains(VOID_ELEMENTS, name) && stack.size() < MAX_DEPTH) {
+        lowered.assign(tag);
+        std::transform(lowered.begin(), lowered.end(), lowered.begin(), to_lower);
+        unsigned added = tag_hints(name, lowered);
+        stack.emplace_back(std::move(name), hints() | added);
+    }
+
+    if (block || hints() != current.hints) {
+        end_run();
+    }
+}
+
+void html::Normalizer::handle_entity(bool terminated) {
+    uint32_t cp = 0;
+    bool known = terminated;
+
+    if (known && entity.size() > 1 && entity[0] == '#') {
+        bool hex = entity[1] == 'x' || entity[1] == 'X';
+        char* parse_end = nullptr;
+        cp = std::strtoul(entity.c_str() + (hex ? 2 : 1), &parse_end, hex ? 16 : 10);
+        known = *parse_end == '\0' && cp > 0 && cp <= 0x10FFFF;
+    } else if (known) {
+        static constexpr std::array<std::pair<std::string_view, uint32_t>, 15> NAMED = {{
+            {"amp", '&'}, {"lt", '<'}, {"gt", '>'}, {"quot", '"'}, {"apos", '\''},
+            {"nbsp", ' '}, {"shy", 0xAD}, {"zwnj", 0x200C}, {"zwj", 0x200D},
+            {"ndash", 0x2013}, {"mdash", 0x2014}, {"hellip", 0x2026}, {"copy", 0xA9},
+            {"reg", 0xAE}, {"euro", 0x20AC}
+        }};
+        auto it = std::find_if(NAMED.begin(), NAMED.end(), [this](const auto& named) { return named.first == entity; });
+        known = it != NAMED.end();
+        if (known) {
+            cp = it->second;
+        }
+    }
+
+    if (!known) {
+        append('&'); // Not an entity, keep it as written
+        for (char c : entity) {
+            append(c);
+        }
+        if (terminated) {
+            append(';');
+        }
+        return;
+    }
+
+    // Invisible characters senders use to pad previews
+    if (cp == 0xAD || cp == 0x34F || (cp >= 0x200B && cp <= 0x200D) || cp == 0xFEFF) {
+        return;
+    }
+    if (cp < 0x80) {
+        append(static_cast<char>(cp));
+        return;
+    }
+    std::string encoded;
+    utf8::append(encoded, cp);
+    for (char c : encoded) {
+        append(c);
+    }
+}
+
+std::vector<html::TextRun> html::normalize(std::string_view data, bool markup) {
+    Normalizer normalizer(markup);
+    normalizer.feed(data);
+    normalizer.finish();
+    return std::move(normalizer).runs();
+}
\ No newline at end of file
@@ -2,12 +2,58 @@
 #include <stdexcept> // For std::runtime_error
 #include <iostream> // For std::cout
 #include <sstream> // For std::istringstream
+#include <mutex> // For std::mutex
+#include <exception> // For std::exception_ptr
+#include <chrono> // For std::chrono::steady_clock
+#include <cmath> // For std::abs
+#include <algorithm> // For std::max, std::find
+#include <cstdlib> // For std::strtoul
 
 #include "logger.hpp"
+#include "metrics.hpp"
+#include "imap_stream.hpp"
+#include "alloc_profiler.hpp"
+#include "perf_profiler.hpp"
+#include "trace.hpp"
+#include "transcript.hpp"
+
+namespace {
+    constexpr long HAPPY_EYEBALLS_MS = 100; // Head start of the first address family before the other one is raced
+    constexpr long DNS_CACHE_SECONDS = 3600; // Lifetime of shared DNS entries, the server address rarely changes
+
+    std::mutex share_mutexes[CURL_LOCK_DATA_LAST]; // One lock per kind of shared data
+
+    void share_lock(CURL*, curl_lock_data data, curl_lock_access, void*) {
+        share_mutexes[data].lock();
+    }
+
+    void share_unlock(CURL*, curl_lock_data data, void*) {
+        share_mutexes[data].unlock();
+    }
+
+    // DNS and TLS session cache shared by all handles, so reconnects skip the lookup and the full handshake
+    CURLSH* shared_cache() {
+        static CURLSH* share = []() {
+            CURLSH* share = curl_share_init();
+            if (share) {
+                curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+                curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+                curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+                curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            }
+            return share;
+        }();
+        return share;
+    }
+
+    // Capabilities per server, so reconnects and further sessions skip the round trip
+    std::mutex capability_mutex;
+    std::map<std::string, std::vector<std::string>> capability_cache;
+}
 
 // Constructor
 IMAPHandler::IMAPHandler(const std::string& server, const std::string& port, const std::string& username, const std::string& password, long timeout, bool verbose)
-    : curl(nullptr), server(server), port(port), username(username), password(password), verbose(verbose), timeout(timeout) {
+    : curl(nullptr), server(server), port(port), username(username), password(password), timeout(timeout), verbose(verbose) {
 }
 
 // Destructor
@@ -18,6 +64,17 @@ IMAPHandler::~IMAPHandler() {
 
 // Initialize the connection
 void IMAPHandler::initialize() {
+    // Replay needs no connection at all
+    if (!replay_path.empty()) {
+        replay = std::make_unique<TranscriptReader>(replay_path);
+        Logger::logger().info("Replaying session from " + replay_path + ".");
+        return;
+    }
+    if (!capture_path.empty()) {
+        capture = std::make_unique<TranscriptWriter>(capture_path);
+        Logger::logger().info("Capturing session to " + capture_path + ".");
+    }
+
     curl = curl_easy_init(); // Initialize CURL
     if (!curl) {
         throw std::runtime_error("Failed to initialize CURL.");
@@ -56,9 +113,43 @@ void IMAPHandler::initialize() {
             throw std::runtime_error("Failed to set CURL header data.");
         }
 
-        // Set timeout options
-        if (curl_easy_setopt(curl, CURLOPT_ACCEPTTIMEOUT_MS, timeout) != CURLE_OK) {
-            throw std::runtime_error("Failed to set CURL timeout.");
+        // Share DNS and TLS sessions with the other handles and race IPv4 against IPv6
+        CURLSH* share = shared_cache();
+        if (share && curl_easy_setopt(curl, CURLOPT_SHARE, share) != CURLE_OK) {
+            throw std::runtime_error("Failed to set CURL share.");
+        }
+        if (curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, DNS_CACHE_SECONDS) != CURLE_OK) {
+            throw std::runtime_error("Failed to set CURL DNS cache timeout.");
+        }
+        if (curl_easy_setopt(curl, CURLOPT_HAPPY_EYEBALLS_TIMEOUT_MS, HAPPY_EYEBALLS_MS) != CURLE_OK) {
+            throw std::runtime_error("Failed to set CURL happy eyeballs timeout.");
+        }
+
+        // The native backend and compression need the raw connection, libcurl only logs in and hands it over
+        if ((use_native || use_compression) && curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 1L) != CURLE_OK) {
+            throw std::runtime_error("Failed to set CURL connect only option.");
+        }
+
+        // Give up on a stalled transfer, the total time per operation is set by apply_deadline()
+        if (curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, deadlines.connect) != CURLE_OK) {
+            throw std::runtime_error("Failed to set CURL connect timeout.");
+        }
+        if (curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L) != CURLE_OK) {
+            throw std::runtime_error("Failed to set CURL low speed limit.");
+        }
+        if (curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, std::max(1L, (timeout + 999) / 1000)) != CURLE_OK) { // Whole seconds only
+            throw std::runtime_error("Failed to set CURL low speed time.");
+        }
+
+        // Check for a cancellation while libcurl waits
+        if (curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, &IMAPHandler::progress_callback) != CURLE_OK) {
+            throw std::runtime_error("Failed to set CURL progress callback.");
+        }
+        if (curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void*)this) != CURLE_OK) {
+            throw std::runtime_error("Failed to set CURL progress data.");
+        }
+        if (curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L) != CURLE_OK) {
+            throw std::runtime_error("Failed to enable CURL progress callback.");
         }
     } catch (const std::exception& e) {
         curl_easy_cleanup(curl); // Clean up CURL on error
@@ -70,26 +161,167 @@ void IMAPHandler::initialize() {
 
 // Connect to the server
 void IMAPHandler::connect() {
-    CURLcode res = curl_easy_perform(curl); // Perform the connection
-    if (res != CURLE_OK) {
-        throw std::runtime_error("Failed to connect to server: " + std::string(curl_easy_strerror(res)));
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_NETWORK); // Waiting for the server, parsing included
+    DeadlineScope scope(*this, deadlines.connect); // Login, capabilities and compression included
+    if (replay) {
+        replay_response(""); // The initial connect is recorded as an empty command
+    } else {
+        if (capture) {
+            capture->write(RECORD_COMMAND, ""); // The initial connect is recorded as an empty command
+        }
+        apply_deadline();
+        CURLcode res = curl_easy_perform(curl); // Perform the connection
+        if (capture) {
+            capture->write(RECORD_END, std::to_string(res));
+        }
+        if (res != CURLE_OK) {
+            throw std::runtime_error("Failed to connect to server: " + std::string(curl_easy_strerror(res)));
+        }
+
+        // Phases of the connect, a reused DNS entry and TLS session show up as near zero
+        curl_off_t dns_us = 0, connect_us = 0, tls_us = 0;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns_us);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect_us);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls_us);
+        metrics::counter("imap.connect_dns_us").set(dns_us);
+        metrics::counter("imap.connect_tcp_us").set(connect_us - dns_us);
+        metrics::counter("imap.connect_tls_us").set(tls_us > connect_us ? tls_us - connect_us : 0);
+        metrics::counter("imap.connects").add(1);
     }
     Logger::logger().info("Connected to server.");
+
+    // Take over the logged-in connection
+    if ((use_native || use_compression) && !replay) {
+        stream = std::make_unique<IMAPStream>(curl, timeout);
+        stream->set_interrupt([this]() { return cancelled(); });
+    }
+    negotiate();
+    if (!paths.compress) {
+        return;
+    }
+
+    try {
+        perform_custom_request("COMPRESS DEFLATE");
+    } catch (const std::exception& e) {
+        Logger::logger().warning("Server refused compression: " + std::string(e.what()));
+        paths.compress = false;
+        return;
+    }
+    if (stream) {
+        stream->enable_compression(); // Everything after the OK is compressed
+    }
+}
+
+// Discover the capabilities and choose the fast paths
+void IMAPHandler::negotiate() {
+    std::string key = server + ":" + port;
+    bool cached = false;
+    if (!capture && !replay) { // Transcripts must contain the same commands on every run
+        std::lock_guard<std::mutex> lock(capability_mutex);
+        auto it = capability_cache.find(key);
+        if (it != capability_cache.end()) {
+            capabilities = it->second;
+            cached = true;
+        }
+    }
+    if (!cached) {
+        capabilities = capability(); // After login, the server may announce more than before
+        std::lock_guard<std::mutex> lock(capability_mutex);
+        capability_cache[key] = capabilities;
+    }
+
+    paths.esearch = supports("ESEARCH");
+    paths.uid_expunge = supports("UIDPLUS");
+    paths.compress = use_compression && supports("COMPRESS=DEFLATE");
+    paths.notify = supports("NOTIFY");
+
+    metrics::counter("imap.fast_path_esearch").set(paths.esearch);
+    metrics::counter("imap.fast_path_uid_expunge").set(paths.uid_expunge);
+    metrics::counter("imap.fast_path_compress").set(paths.compress);
+    metrics::counter("imap.fast_path_notify").set(paths.notify);
+    if (cached) {
+        Logger::logger().debug("Fast paths for " + key + ": " + paths.describe()); // Already logged for this server
+    } else {
+        Logger::logger().info("Fast paths for " + key + ": " + paths.describe());
+    }
+    if (use_compression && !paths.compress) {
+        Logger::logger().warning("Server does not support COMPRESS=DEFLATE, continuing uncompressed.");
+    }
 }
 
 // Disconnect from the server
 void IMAPHandler::disconnect() {
     if (curl) {
         Logger::logger().info("Disconnecting from server..."); // Log the disconnection
+        stream.reset(); // The stream uses the CURL handle, release it first
+        if (unresponsive) {
+            curl_easy_setopt(curl, CURLOPT_SERVER_RESPONSE_TIMEOUT, 1L); // Do not wait for the LOGOUT of a dead session
+        }
         curl_easy_cleanup(curl); // Clean up CURL
         curl = nullptr; // Set CURL handle to null
     }
 }
 
+// Whether the cancel token fired since the running operation started
+bool IMAPHandler::cancelled() const {
+    return cancel_token && cancel_token->cancelled_since(cancel_generation);
+}
+
+// Hand the remaining time of the running operation to libcurl or the stream
+void IMAPHandler::apply_deadline() {
+    if (cancelled()) {
+        throw std::runtime_error("IMAP operation cancelled.");
+    }
+    long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+        throw std::runtime_error("IMAP operation exceeded its deadline.");
+    }
+    if (stream) {
+        stream->set_deadline(deadline);
+    } else if (curl) {
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, remaining);
+    }
+}
+
+IMAPHandler::DeadlineScope::DeadlineScope(IMAPHandler& handler, long milliseconds)
+    : handler(handler), outermost(handler.deadline == std::chrono::steady_clock::time_point::max()) {
+    if (outermost) {
+        handler.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+        handler.cancel_generation = handler.cancel_token ? handler.cancel_token->current() : 0; // Only later cancels count
+    }
+}
+
+IMAPHandler::DeadlineScope::~DeadlineScope() {
+    if (outermost) {
+        handler.deadline = std::chrono::steady_clock::time_point::max();
+    }
+}
+
 // Perform a custom request to the IMAP server
 Response IMAPHandler::perform_custom_request(const std::string cmd){
+    trace::Span span("perform_custom_request", cmd); // Trace the request, tagged with the command
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_NETWORK); // Waiting for the server, parsing included
+    DeadlineScope scope(*this, deadlines.command); // Unless the operation set its own
     Logger::logger().debug("Performing custom request: " + cmd); // Log the custom request
 
+    // Queued deletes travel in the same round trip
+    if (!pending_deletes.empty()) {
+        return perform_pipelined({cmd}).back();
+    }
+    if (replay) {
+        return replay_response(cmd); // Answer from the transcript instead of the network
+    }
+
+    apply_deadline();
+
+    // Raw channel, libcurl does not know about the compression layer
+    if (stream) {
+        return receive_stream(cmd, stream->send(cmd)); // Send the command and wait for its completion
+    }
+    if (capture) {
+        capture->write(RECORD_COMMAND, cmd);
+    }
+
     // Set the command to be sent in the request
     curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, cmd.c_str()); // Set the custom request command
 
@@ -99,6 +331,9 @@ Response IMAPHandler::perform_custom_request(const std::string cmd){
 
     // Perform the request
     CURLcode res = curl_easy_perform(curl); // Perform the request
+    if (capture) {
+        capture->write(RECORD_END, std::to_string(res));
+    }
     if (res != CURLE_OK) {
         throw std::runtime_error("Failed to perform request: " + std::string(curl_easy_strerror(res)));
     }
@@ -115,58 +350,259 @@ Response IMAPHandler::perform_custom_request(const std::string cmd){
     return last_response; // Return the response data
 }
 
-// ===================================
-// Request functions
-// ===================================
-Response IMAPHandler::select(std::string mailbox){
-    // Set the select command for the given mailbox
-    std::string cmd = "SELECT " + mailbox; // Create the select command
-    return perform_custom_request(cmd); // Perform the request and return the response
+// Send all commands before waiting for the first completion.
+// Only for commands whose results do not depend on each other (RFC 3501, section 5.5).
+std::vector<Response> IMAPHandler::perform_pipelined(const std::vector<std::string>& cmds){
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_NETWORK); // Waiting for the server, parsing included
+    DeadlineScope scope(*this, pending_deletes.empty() ? deadlines.command : deadlines.store); // Unless the operation set its own
+    std::vector<std::string> all = delete_commands(pending_deletes, paths.uid_expunge); // Queued deletes go first
+    pending_deletes.clear();
+    all.insert(all.end(), cmds.begin(), cmds.end());
+
+    std::vector<Response> responses;
+    if (all.empty()) {
+        return responses;
+    }
+    if (!stream) {
+        // libcurl and replay handle one command at a time
+        for (const std::string& cmd : all) {
+            responses.push_back(perform_custom_request(cmd));
+        }
+        return std::vector<Response>(responses.end() - cmds.size(), responses.end());
+    }
+
+    trace::Span span("perform_pipelined", all.front()); // Trace the batch, tagged with its first command
+    apply_deadline();
+    std::vector<std::string> tags;
+    for (const std::string& cmd : all) {
+        Logger::logger().debug("Pipelining request: " + cmd); // Log the pipelined request
+        tags.push_back(stream->send(cmd));
+    }
+
+    // Collect every completion, even after a failure, so the stream stays in sync
+    std::exception_ptr failure;
+    for (size_t i = 0; i < all.size(); i++) {
+        try {
+            responses.push_back(receive_stream(all[i], tags[i]));
+        } catch (...) {
+            if (!failure) {
+                failure = std::current_exception();
+            }
+            responses.emplace_back(CURLE_QUOTE_ERROR);
+        }
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+    return std::vector<Response>(responses.end() - cmds.size(), responses.end());
 }
 
-// Perform a raw search with the given criteria
-Response IMAPHandler::raw_search(std::string criteria){
-    // Set the search command
-    std::string cmd = "UID SEARCH " + criteria; // Create the search command
-    return perform_custom_request(cmd); // Perform the request and return the response
+// Check that the idle connection is still alive and measure its round-trip time
+bool IMAPHandler::probe(long min_timeout){
+    static metrics::Counter& probes = metrics::counter("imap.probes");
+    static metrics::Counter& late = metrics::counter("imap.probes_late");
+    static metrics::Counter& rtt = metrics::counter("imap.rtt_us");
+
+    long limit = std::max(min_timeout, static_cast<long>(srtt + 4 * rttvar)); // Retransmission timeout of RFC 6298
+    bool sample = pending_deletes.empty(); // Queued deletes would be timed along with the NOOP
+    probes.add();
+
+    auto start = std::chrono::steady_clock::now();
+    try {
+        DeadlineScope scope(*this, limit); // A dead connection has to fail within the limit instead of the regular deadline
+        perform_custom_request("NOOP");
+    } catch (const std::exception& e) {
+        unresponsive = true; // Until the next probe succeeds
+        late.add();
+        Logger::logger().warning("Probe failed: " + std::string(e.what()));
+        return false;
+    }
+    unresponsive = false;
+
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (sample) {
+        if (srtt == 0) {
+            srtt = elapsed;
+            rttvar = elapsed / 2;
+        } else {
+            rttvar = 0.75 * rttvar + 0.25 * std::abs(srtt - elapsed);
+            srtt = 0.875 * srtt + 0.125 * elapsed;
+        }
+        rtt.set(static_cast<uint64_t>(srtt * 1000));
+    }
+    if (elapsed > limit) {
+        late.add();
+        Logger::logger().warning("Probe took " + std::to_string(static_cast<long>(elapsed)) + " ms, limit was " + std::to_string(limit) + " ms.");
+        return false;
+    }
+    return true;
 }
 
-// Perform a search with the given criteria and return a vector of UIDs
-std::vector<std::string> IMAPHandler::search(std::string criteria){
-    // Perform the search request
-    Response response = raw_search(criteria); // Perform the search request
+// Complete a command sent on the stream and record it like a libcurl request
+Response IMAPHandler::receive_stream(const std::string& cmd, const std::string& tag){
+    if (capture) {
+        capture->write(RECORD_COMMAND, cmd);
+    }
+    try {
+        last_response = stream->receive(tag); // Wait for the completion of the command
+    } catch (const std::exception&) {
+        if (capture) {
+            capture->write(RECORD_END, std::to_string(CURLE_QUOTE_ERROR)); // Record the failure like libcurl reports it
+        }
+        throw;
+    }
+    if (capture) {
+        capture->write(RECORD_HEADER, last_response.header); // The stream delivers whole responses
+        capture->write(RECORD_DATA, last_response.data);
+        capture->write(RECORD_END, std::to_string(CURLE_OK));
+    }
+    Logger::logger().debug("Response header: " + last_response.header); // Log the response header
+    Logger::logger().debug("Response data: " + last_response.data); // Log the response data
+    return last_response;
+}
+
+// Feed the next recorded response through the callbacks, exactly as libcurl would
+Response IMAPHandler::replay_response(const std::string& cmd){
+    TranscriptRecord type;
+    uint64_t time;
+    std::string bytes;
+
+    // Find the recorded command
+    if (!replay->next(type, time, bytes)) {
+        throw std::runtime_error("Replay transcript exhausted.");
+    }
+    if (type != RECORD_COMMAND) {
+        throw std::runtime_error("Replay transcript out of sync.");
+    }
+    if (bytes != cmd) {
+        Logger::logger().warning("Replayed command differs: recorded \"" + bytes + "\", sent \"" + cmd + "\"."); // Log mismatch, the answer is used anyway
+    }
+
+    userdata.clear();
+    headerdata.clear();
+
+    // Pass the recorded chunks to the callbacks until the end of the response
+    while (replay->next(type, time, bytes)) {
+        if (type == RECORD_HEADER) {
+            header_callback(bytes.data(), 1, bytes.size(), this);
+        } else if (type == RECORD_DATA) {
+            write_callback(bytes.data(), 1, bytes.size(), this);
+        } else if (type == RECORD_END) {
+            CURLcode res = static_cast<CURLcode>(std::stoi(bytes));
+            if (res != CURLE_OK) {
+                throw std::runtime_error("Failed to perform request: " + std::string(curl_easy_strerror(res)));
+            }
+
+            last_response.code = res; // Store the response code
+            last_response.header = headerdata; // Store the header data
+            last_response.data = userdata; // Store the userdata
+            return last_response;
+        }
+    }
+
+    throw std::runtime_error("Replay transcript ends inside a response.");
+}
+
+// ===================================
+// Request functions
+// ===================================
+std::vector<std::string> IMAPHandler::capability(){
+    Response response = perform_custom_request("CAPABILITY"); // Ask the server for its capabilities
 
     std::istringstream iss(response.data); // Create a string stream from the response data
     std::string word;
 
-    // Skip the first part of the response until we find the word "SEARCH"
+    // Skip everything up to the CAPABILITY keyword
     while (iss >> word) {
-        if(word == "SEARCH"){
+        if(word == "CAPABILITY"){
             break;
         }
     }
 
-    // Now we can read the UIDs of unseen emails
-    std::vector<std::string> uids;
+    std::vector<std::string> capabilities;
     std::string line;
-
     if (std::getline(iss, line)) { // Read only the first line
         std::istringstream line_stream(line);
         while (line_stream >> word) {
-            uids.push_back(word); // Store the UID in the vector
+            capabilities.push_back(word); // Store the capability
         }
     }
 
-    Logger::logger().debug("Found " + std::to_string(uids.size()) + " emails."); // Log the number of found emails
-    for (const auto& uid : uids) {
-        Logger::logger().debug("UID: " + uid); // Log the UID of each unseen email
+    Logger::logger().debug("Server capabilities: " + line); // Log the capabilities
+    return capabilities; // Return the capabilities
+}
+
+Response IMAPHandler::select(std::string mailbox){
+    // Set the select command for the given mailbox
+    std::string cmd = "SELECT \"" + mailbox + "\""; // Create the select command (quoted, names may contain spaces)
+    Response response = perform_custom_request(cmd); // Perform the request
+
+    // Remember the UIDVALIDITY, UIDs are only stable as long as it does not change
+    uidvalidity.clear();
+    size_t pos = response.data.find("[UIDVALIDITY ");
+    if (pos != std::string::npos) {
+        pos += 13; // Skip "[UIDVALIDITY "
+        uidvalidity = response.data.substr(pos, response.data.find(']', pos) - pos);
     }
 
-    return uids; // Return the vector of UIDs
+    return response; // Return the response
+}
+
+// Perform a raw search with the given criteria
+Response IMAPHandler::raw_search(std::string criteria){
+    DeadlineScope scope(*this, deadlines.search);
+    // Set the search command
+    std::string cmd = "UID SEARCH " + criteria; // Create the search command
+    return perform_custom_request(cmd); // Perform the request and return the response
+}
+
+// Perform a search with the given criteria and return the matching UIDs
+UidSet IMAPHandler::search(std::string criteria){
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_SEARCH); // Attribute allocations to this stage
+    DeadlineScope scope(*this, deadlines.search);
+
+    // ESEARCH answers with a sequence set instead of one number per email
+    Response response = raw_search(paths.esearch ? "RETURN (MIN MAX ALL) " + criteria : criteria); // Perform the search request
+    UidSet uids = parse_search(response.data);
+
+    Logger::logger().debug("Found " + std::to_string(uids.size()) + " emails: " + uids.to_string()); // Log the found emails
+    return uids;
 }
 
-// Perform a search for emails from the given sender and return a vector of UIDs
-std::vector<std::string> IMAPHandler::search_from(std::string from){
+// Read the UIDs of an untagged SEARCH or ESEARCH response
+UidSet IMAPHandler::parse_search(const std::string& data){
+    UidSet uids;
+    std::istringstream iss(data);
+    std::string line;
+    while (std::getline(iss, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        if (line.starts_with("* SEARCH")) {
+            uids.insert(UidSet::parse(std::string_view(line).substr(8))); // Space separated UIDs
+        } else if (line.starts_with("* ESEARCH")) {
+            // * ESEARCH (TAG "A1") UID MIN 2 MAX 9 ALL 2:4,9
+            std::istringstream words(line.substr(line.find(')') == std::string::npos ? 9 : line.find(')') + 1));
+            std::string key, value;
+            while (words >> key) {
+                if (key == "UID") {
+                    continue; // No value
+                }
+                if (!(words >> value)) {
+                    break;
+                }
+                if (key == "ALL" || key == "MIN" || key == "MAX") {
+                    uids.insert(UidSet::parse(value)); // ALL includes MIN and MAX, they only matter without it
+                }
+            }
+        }
+    }
+    return uids;
+}
+
+// Perform a search for emails from the given sender and return the matching UIDs
+UidSet IMAPHandler::search_from(std::string from){
     // Set the search criteria for unseen emails from the given sender
     std::string criteria = "FROM \"" + from + "\""; // Create the search criteria
     return search(criteria); // Perform the search and return the UIDs
@@ -174,12 +610,16 @@ std::vector<std::string> IMAPHandler::search_from(std::string from){
 
 // Perform a raw fetch with the given UID and data
 Response IMAPHandler::raw_fetch(std::string uid, std::string data){
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_FETCH); // Attribute allocations to this stage
+    DeadlineScope scope(*this, deadlines.fetch);
     // Set the fetch command
     std::string cmd = "UID FETCH " + uid + " " + data; // Create the fetch command
     return perform_custom_request(cmd); // Perform the request and return the response
 }
 
 Response IMAPHandler::fetch_internaldate(std::string uid){
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_FETCH); // Attribute allocations to this stage
+    DeadlineScope scope(*this, deadlines.fetch);
     // Set the fetch command for internal date
     std::string cmd = "UID FETCH " + uid + " INTERNALDATE"; // Create the fetch command for internal date
     return perform_custom_request(cmd); // Perform the request and return the response
@@ -187,40 +627,160 @@ Response IMAPHandler::fetch_internaldate(std::string uid){
 
 
 Response IMAPHandler::fetch_body(std::string uid, int part){
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_FETCH); // Attribute allocations to this stage
+    DeadlineScope scope(*this, deadlines.fetch);
     if(part < 0){
         // Set the fetch command for body
-        std::string cmd = "UID FETCH " + uid + " BODY[]"; // Create the fetch command for body
+        std::string cmd = "UID FETCH " + uid + " BODY.PEEK[]"; // Create the fetch command for body (PEEK leaves \Seen untouched)
         return perform_custom_request(cmd); // Perform the request and return the response
     }
     else{
-        std::string cmd = "UID FETCH " + uid + " BODY[" + std::to_string(part) + "]"; // Create the fetch command for body part
+        std::string cmd = "UID FETCH " + uid + " BODY.PEEK[" + std::to_string(part) + "]"; // Create the fetch command for body part
         return perform_custom_request(cmd); // Perform the request and return the response
     }
 }
 
+Response IMAPHandler::fetch_bodystructure(std::string uid){
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_FETCH); // Attribute allocations to this stage
+    DeadlineScope scope(*this, deadlines.fetch);
+    // Set the fetch command for the MIME structure
+    std::string cmd = "UID FETCH " + uid + " BODYSTRUCTURE"; // Create the fetch command for the body structure
+    return perform_custom_request(cmd); // Perform the request and return the response
+}
+
+// Pass the first limit bytes of a body part to the consumer while they arrive
+Response IMAPHandler::fetch_body_streaming(std::string uid, const std::string& section, size_t limit, const LiteralConsumer& consumer){
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_FETCH); // Attribute allocations to this stage
+    DeadlineScope scope(*this, deadlines.fetch);
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_NETWORK); // The consumer switches to decode and extract
+    std::string cmd = "UID FETCH " + uid + " BODY.PEEK[" + section + "]<0." + std::to_string(limit) + ">"; // Create the partial fetch command
+
+    // Queued deletes go first, so the body is the only literal in flight
+    if (!pending_deletes.empty()) {
+        perform_pipelined({});
+    }
+
+    // The stream returns as soon as the consumer is done, the remainder is drained before the next command
+    if (stream && !capture) {
+        Logger::logger().debug("Performing streaming request: " + cmd); // Log the request
+        apply_deadline();
+        last_response = stream->receive_streaming(stream->send(cmd), consumer);
+        return last_response;
+    }
+
+    // libcurl and the capture need the whole response, the tap keeps the literal out of the buffers
+    LiteralTap literal_tap(consumer);
+    if (stream) {
+        Response response = perform_custom_request(cmd);
+        last_response.header.clear();
+        literal_tap.feed(response.header, last_response.header);
+        return last_response;
+    }
+    tap = &literal_tap;
+    try {
+        perform_custom_request(cmd);
+    } catch (...) {
+        tap = nullptr;
+        throw;
+    }
+    tap = nullptr;
+    return last_response;
+}
+
+// Fetch the given header fields and the INTERNALDATE of several emails in one request, returns them per UID
+std::map<uint32_t, HeaderFields> IMAPHandler::fetch_header_fields(const UidSet& uids, const std::string& fields){
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_FETCH); // Attribute allocations to this stage
+    DeadlineScope scope(*this, deadlines.fetch);
+    std::map<uint32_t, HeaderFields> result;
+    if (uids.empty()) {
+        return result; // Nothing to fetch
+    }
+
+    std::string cmd = "UID FETCH " + uids.to_string() + " (UID INTERNALDATE BODY.PEEK[HEADER.FIELDS (" + fields + ")])"; // Create the fetch command
+    Response response = perform_custom_request(cmd); // Perform the request
 
-Response IMAPHandler::delete_uids(std::vector<std::string> uids){
-    // Build string out of UIDs
-    std::string uid_string = ""; // Initialize an empty string for UIDs
-    for(int i = 0; i < uids.size(); i++){
-        uid_string += uids[i]; // Append each UID to the string
-        if(i != uids.size() - 1){
-            uid_string += ","; // Add a comma between UIDs
+    // Walk the response line by line, skipping over the literals holding the header fields
+    const std::string& text = response.header;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t eol = text.find("\r\n", pos);
+        if (eol == std::string::npos) {
+            break;
+        }
+        std::string line = text.substr(pos, eol - pos);
+        pos = eol + 2;
+
+        if (!line.starts_with("* ") || line.find(" FETCH (") == std::string::npos) {
+            continue; // Not a FETCH response
+        }
+
+        // Read the literal announced at the end of the line
+        std::string fields_data;
+        size_t open = line.rfind('{');
+        if (open != std::string::npos && line.ends_with("}")) {
+            size_t length = std::stoul(line.substr(open + 1, line.size() - open - 2));
+            fields_data = text.substr(pos, length);
+            pos += length;
+
+            // The UID may also follow the literal, so include the rest of the response in the search
+            size_t rest = text.find("\r\n", pos);
+            line += text.substr(pos, rest == std::string::npos ? std::string::npos : rest - pos);
+        }
+
+        size_t uid_pos = line.find("UID ");
+        if (uid_pos == std::string::npos) {
+            continue; // Response without UID
         }
+        uint32_t uid = std::strtoul(line.c_str() + uid_pos + 4, nullptr, 10);
+        if (!uids.contains(uid)) {
+            continue;
+        }
+        HeaderFields& entry = result[uid];
+        entry.fields = fields_data; // Store the header fields of this email
+
+        size_t date_pos = line.find("INTERNALDATE \"");
+        if (date_pos != std::string::npos) {
+            size_t start = date_pos + 14;
+            entry.internaldate = line.substr(start, line.find('"', start) - start);
+        }
+    }
+
+    return result;
+}
+
+// Commands deleting the given UIDs, empty if there are none
+std::vector<std::string> IMAPHandler::delete_commands(const UidSet& uids, bool uid_expunge){
+    if (uids.empty()) {
+        return {};
     }
 
+    std::string uid_string = uids.to_string(); // Consecutive UIDs collapse into ranges
     Logger::logger().debug("Deleting UIDs: " + uid_string); // Log the UIDs to be deleted
 
-    // Set the delete command for the given UIDs
-    std::string cmd = "UID STORE " + uid_string + " +FLAGS (\\Deleted)"; // Create the delete command
-    perform_custom_request(cmd); // Perform the request and return the response
+    // The server runs the EXPUNGE after the STORE, even when both are pipelined
+    return {
+        "UID STORE " + uid_string + " +FLAGS.SILENT (\\Deleted)", // Flag the emails, without echoing the flags
+        uid_expunge ? "UID EXPUNGE " + uid_string : "EXPUNGE" // Expunge the deleted emails, with UIDPLUS only ours
+    };
+}
 
-    // Expunge the deleted emails
-    cmd = "EXPUNGE"; // Create the expunge command
+Response IMAPHandler::delete_uids(const UidSet& uids){
+    DeadlineScope scope(*this, deadlines.store);
+    std::vector<Response> responses = perform_pipelined(delete_commands(uids, paths.uid_expunge)); // STORE and EXPUNGE in one round trip
     Logger::logger().info("Deleted emails and performed expunge.");
-    return perform_custom_request(cmd); // Perform the request and return the response
+    return responses.empty() ? last_response : responses.back();
 }
 
+// Delete the UIDs together with the next request instead of waiting for a round trip of their own
+void IMAPHandler::queue_delete(const UidSet& uids){
+    pending_deletes.insert(uids);
+}
+
+
+// Progress callback, called about once a second while libcurl waits, non-zero aborts the transfer
+int IMAPHandler::progress_callback(void* data, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+    return static_cast<IMAPHandler*>(data)->cancelled() ? 1 : 0;
+}
 
 // Callback function for writing data
 size_t IMAPHandler::write_callback(char* ptr, size_t size, size_t nmemb, void* data) {
@@ -232,6 +792,10 @@ size_t IMAPHandler::write_callback(char* ptr, size_t size, size_t nmemb, void* d
     IMAPHandler* handler = static_cast<IMAPHandler*>(data); // Cast the data pointer to IMAPHandler
     handler->userdata.append(ptr, total_size); // Append the data to the userdata buffer
 
+    if (handler->capture) {
+        handler->capture->write(RECORD_DATA, ptr, total_size); // Record the raw chunk
+    }
+
     return total_size; // Return the total size of the data
 }
 
@@ -243,7 +807,20 @@ size_t IMAPHandler::header_callback(char* buffer, size_t size, size_t nitems, vo
     }
     size_t total_size = size * nitems; // Calculate the total size of the header data
     IMAPHandler* handler = static_cast<IMAPHandler*>(data); // Cast the data pointer to IMAPHandler
-    handler->headerdata.append(buffer, total_size); // Append the header data to the headerdata buffer
+    if (handler->tap) {
+        handler->tap->feed(std::string_view(buffer, total_size), handler->headerdata); // Literals go to the streaming consumer
+    } else {
+        handler->headerdata.append(buffer, total_size); // Append the header data to the headerdata buffer
+    }
+
+    if (handler->capture) {
+        handler->capture->write(RECORD_HEADER, buffer, total_size); // Record the raw chunk
+    }
+
+    // Every server line passes through here. libcurl never compresses, so these are the decoded bytes;
+    // imap.bytes_wire_* and imap.bytes_payload_* are only counted by the raw stream, where they differ.
+    static metrics::Counter& curl_in = metrics::counter("imap.bytes_curl_in");
+    curl_in.add(total_size);
     
     return total_size; // Return the total size of the header data
 }
@@ -253,6 +830,42 @@ void IMAPHandler::set_verbose(bool verbose) {
     this->verbose = verbose;
 }
 
+void IMAPHandler::set_deadlines(const Deadlines& deadlines) {
+    this->deadlines = deadlines;
+}
+
+void IMAPHandler::set_cancel_token(std::shared_ptr<CancelToken> token) {
+    cancel_token = std::move(token);
+}
+
+void IMAPHandler::set_compression(bool compression) {
+    this->use_compression = compression;
+}
+
+void IMAPHandler::set_capture(const std::string& path) {
+    this->capture_path = path;
+}
+
+void IMAPHandler::set_replay(const std::string& path) {
+    this->replay_path = path;
+}
+
+bool IMAPHandler::get_compression() const {
+    return use_compression;
+}
+
+void IMAPHandler::set_native(bool native) {
+    this->use_native = native;
+}
+
+bool IMAPHandler::get_native() const {
+    return use_native;
+}
+
+double IMAPHandler::get_rtt() const {
+    return srtt;
+}
+
 std::string IMAPHandler::get_username() const {
     return username;
 }
@@ -269,6 +882,26 @@ std::string IMAPHandler::get_port() const {
     return port;
 }
 
+std::string IMAPHandler::get_uidvalidity() const {
+    return uidvalidity;
+}
+
+bool IMAPHandler::supports(const std::string& capability) const {
+    return std::find(capabilities.begin(), capabilities.end(), capability) != capabilities.end();
+}
+
+const FastPaths& IMAPHandler::get_fast_paths() const {
+    return paths;
+}
+
+// Active paths and fallbacks for the log
+std::string FastPaths::describe() const {
+    return std::string("search ") + (esearch ? "ESEARCH" : "SEARCH")
+        + ", delete " + (uid_expunge ? "UID EXPUNGE" : "EXPUNGE")
+        + ", " + (compress ? "COMPRESS=DEFLATE" : "uncompressed")
+        + ", watch " + (notify ? "NOTIFY" : "per mailbox");
+}
+
 bool IMAPHandler::get_use_ssl() const {
     return use_ssl;
 }
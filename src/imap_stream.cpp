@@ -0,0 +1,344 @@
+#include "imap_stream.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+
+#include <stdexcept>
+#include <string_view>
+#include <cctype>
+#include <algorithm>
+#include <chrono>
+
+#ifndef _WIN32
+#include <sys/select.h>
+#endif
+
+// Byte counters shared by all streams, wire / payload is the compression ratio
+static metrics::Counter& wire_in = metrics::counter("imap.bytes_wire_in");
+static metrics::Counter& wire_out = metrics::counter("imap.bytes_wire_out");
+static metrics::Counter& payload_in = metrics::counter("imap.bytes_payload_in");
+static metrics::Counter& payload_out = metrics::counter("imap.bytes_payload_out");
+static metrics::Counter& early_exits = metrics::counter("imap.stream_early_exits");
+
+static constexpr long INTERRUPT_CHECK_MS = 200; // Longest wait between two checks for a cancellation
+
+// Returns the size of the literal announced at the end of a response line ("{123}\r\n"), or 0
+static size_t literal_length(std::string_view line) {
+    if (line.size() < 5 || !line.ends_with("}\r\n")) {
+        return 0; // No literal announced
+    }
+
+    size_t open = line.rfind('{');
+    if (open == std::string_view::npos) {
+        return 0;
+    }
+
+    size_t length = 0;
+    for (size_t i = open + 1; i < line.size() - 3; i++) {
+        if (!std::isdigit(static_cast<unsigned char>(line[i]))) {
+            return 0; // Not a literal, just a brace in the text
+        }
+        length = length * 10 + (line[i] - '0');
+    }
+    return length;
+}
+
+// Constructor
+IMAPStream::IMAPStream(CURL* curl, long timeout) : curl(curl), timeout(timeout) {
+}
+
+// Wait until the socket is readable or writable
+void IMAPStream::wait_socket(bool for_recv) {
+    curl_socket_t sockfd;
+    if (curl_easy_getinfo(curl, CURLINFO_ACTIVESOCKET, &sockfd) != CURLE_OK || sockfd == CURL_SOCKET_BAD) {
+        throw std::runtime_error("Failed to get socket of the IMAP connection.");
+    }
+
+    // Wait in slices, so a cancellation or the deadline ends the wait early
+    auto idle_end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    while (true) {
+        if (interrupted && interrupted()) {
+            throw std::runtime_error("IMAP operation cancelled.");
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            throw std::runtime_error("IMAP operation exceeded its deadline.");
+        }
+        if (now >= idle_end) {
+            throw std::runtime_error("Timed out waiting for the IMAP server.");
+        }
+        auto end = std::min(idle_end, deadline);
+        long slice = std::min(INTERRUPT_CHECK_MS, static_cast<long>(std::chrono::ceil<std::chrono::milliseconds>(end - now).count()));
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sockfd, &fds);
+
+        timeval tv;
+        tv.tv_sec = slice / 1000;
+        tv.tv_usec = (slice % 1000) * 1000;
+
+        int res = select(static_cast<int>(sockfd) + 1, for_recv ? &fds : nullptr, for_recv ? nullptr : &fds, nullptr, &tv);
+        if (res > 0) {
+            return;
+        }
+        if (res < 0) {
+            throw std::runtime_error("Failed to wait for the IMAP socket.");
+        }
+    }
+}
+
+// Send data through the compression layer
+void IMAPStream::send_all(const std::string& data) {
+    outbuf.clear();
+    if (deflater) {
+        deflater->compress(data.data(), data.size(), outbuf); // Compress the command
+    } else {
+        outbuf = data;
+    }
+
+    size_t offset = 0;
+    while (offset < outbuf.size()) {
+        size_t sent = 0;
+        CURLcode res = curl_easy_send(curl, outbuf.data() + offset, outbuf.size() - offset, &sent);
+        if (res == CURLE_AGAIN) {
+            wait_socket(false); // Socket buffer is full, wait until it drains
+            continue;
+        }
+        if (res != CURLE_OK) {
+            throw std::runtime_error("Failed to send request: " + std::string(curl_easy_strerror(res)));
+        }
+        offset += sent;
+    }
+
+    wire_out.add(outbuf.size());
+    payload_out.add(data.size());
+}
+
+// Receive more data into inbuf
+void IMAPStream::fill() {
+    char chunk[16384];
+    size_t received = 0;
+
+    CURLcode res = curl_easy_recv(curl, chunk, sizeof(chunk), &received);
+    if (res == CURLE_AGAIN) {
+        wait_socket(true); // Nothing there yet, wait for the server
+        return;
+    }
+    if (res != CURLE_OK) {
+        throw std::runtime_error("Failed to receive response: " + std::string(curl_easy_strerror(res)));
+    }
+    if (received == 0) {
+        throw std::runtime_error("Connection closed by server.");
+    }
+
+    // Drop data that has already been consumed before growing the buffer
+    if (inpos > 0) {
+        inbuf.erase(0, inpos);
+        inpos = 0;
+    }
+
+    size_t before = inbuf.size();
+    if (inflater) {
+        inflater->decompress(chunk, received, inbuf); // Decompress the received data
+    } else {
+        inbuf.append(chunk, received);
+    }
+
+    wire_in.add(received);
+    payload_in.add(inbuf.size() - before);
+}
+
+// Send a command without waiting for its completion, returns its tag
+std::string IMAPStream::send(const std::string& cmd) {
+    std::string tag = "T" + std::to_string(++tag_counter); // Create a unique tag
+    send_all(tag + " " + cmd + "\r\n");
+    in_flight.push_back(tag);
+    return tag;
+}
+
+// Read responses up to the next tagged completion.
+// Like libcurl, every received line ends up in the header and untagged lines also in the data.
+// The server completes pipelined commands in order, so untagged lines belong to the oldest command in flight.
+// Also returns when a streaming consumer stopped, the rest of the literal is read by the next call.
+void IMAPStream::read_completion() {
+    while (true) {
+        bool dropped = !in_flight.empty() && abandoned.contains(in_flight.front()); // Nobody waits for this response anymore
+
+        // Literal data is copied verbatim and never interpreted as a response line
+        if (literal_left > 0) {
+            size_t available = std::min(literal_left, inbuf.size() - inpos);
+            if (available == 0) {
+                fill();
+                continue;
+            }
+            std::string_view data(inbuf.data() + inpos, available);
+            inpos += available;
+            literal_left -= available;
+
+            if (consumer && in_flight.front() == consumer_tag) {
+                if (!(*consumer)(data)) {
+                    consumer_stopped = true;
+                    return;
+                }
+            } else if (!dropped) {
+                current.header.append(data);
+            }
+            continue;
+        }
+
+        size_t eol = inbuf.find("\r\n", inpos);
+        if (eol == std::string::npos) {
+            fill(); // Incomplete line, receive more data
+            continue;
+        }
+
+        std::string_view line(inbuf.data() + inpos, eol + 2 - inpos);
+        inpos = eol + 2;
+
+        literal_left = literal_length(line); // Check if a literal follows this line
+
+        if (line.starts_with("* ")) {
+            if (!dropped) {
+                current.header.append(line);
+                current.data.append(line); // Untagged response
+            }
+            continue;
+        }
+        if (!dropped) {
+            current.header.append(line);
+        }
+
+        // Tagged completion of one of the commands in flight
+        std::string_view tag = line.substr(0, line.find(' '));
+        auto it = std::find(in_flight.begin(), in_flight.end(), tag);
+        if (it == in_flight.end() || tag.size() == line.size()) {
+            continue; // Continuation request or unknown tag
+        }
+        in_flight.erase(it);
+
+        if (abandoned.erase(std::string(tag)) > 0) {
+            current = Response(); // The early stop already returned this response
+            continue;
+        }
+
+        std::string_view status = line.substr(tag.size() + 1);
+        std::string error;
+        if (!status.starts_with("OK")) {
+            error = "Failed to perform request: " + std::string(line.substr(0, line.size() - 2));
+        }
+        current.code = error.empty() ? CURLE_OK : CURLE_QUOTE_ERROR;
+        completed.emplace(std::string(tag), std::make_pair(std::move(current), std::move(error)));
+        current = Response();
+        return;
+    }
+}
+
+// Read responses until the command with the given tag completed, throws if it failed
+Response IMAPStream::receive(const std::string& tag) {
+    while (!completed.contains(tag)) {
+        if (std::find(in_flight.begin(), in_flight.end(), tag) == in_flight.end()) {
+            throw std::runtime_error("No command in flight with tag " + tag + ".");
+        }
+        read_completion();
+    }
+
+    auto node = completed.extract(tag);
+    auto& [response, error] = node.mapped();
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+    return std::move(response);
+}
+
+// Like receive(), but literal data goes to the consumer until it returns false
+Response IMAPStream::receive_streaming(const std::string& tag, const LiteralConsumer& consumer) {
+    this->consumer = &consumer;
+    consumer_tag = tag;
+    consumer_stopped = false;
+
+    try {
+        while (!completed.contains(tag)) {
+            if (std::find(in_flight.begin(), in_flight.end(), tag) == in_flight.end()) {
+                throw std::runtime_error("No command in flight with tag " + tag + ".");
+            }
+            read_completion();
+
+            if (consumer_stopped) {
+                // Give back what arrived so far, the remainder is dropped by later reads
+                this->consumer = nullptr;
+                abandoned.insert(tag);
+                early_exits.add();
+                Response response = std::move(current);
+                current = Response();
+                response.code = CURLE_OK;
+                return response;
+            }
+        }
+    } catch (...) {
+        this->consumer = nullptr;
+        throw;
+    }
+
+    this->consumer = nullptr;
+    return receive(tag);
+}
+
+// Switch on the compression layer after the server accepted COMPRESS DEFLATE
+void IMAPStream::enable_compression() {
+    if (deflater) {
+        return; // Already active
+    }
+
+    // Everything after the tagged OK is compressed in both directions
+    deflater = std::make_unique<compression::Deflater>();
+    inflater = std::make_unique<compression::Inflater>();
+
+    // Data received after the OK already belongs to the compressed stream
+    std::string pending = inbuf.substr(inpos);
+    inbuf.clear();
+    inpos = 0;
+    if (!pending.empty()) {
+        inflater->decompress(pending.data(), pending.size(), inbuf);
+    }
+
+    Logger::logger().info("COMPRESS=DEFLATE enabled.");
+}
+
+// Setter implementations
+void IMAPStream::set_deadline(std::chrono::steady_clock::time_point deadline) {
+    this->deadline = deadline;
+}
+
+void IMAPStream::set_interrupt(std::function<bool()> interrupted) {
+    this->interrupted = std::move(interrupted);
+}
+
+// Constructor
+LiteralTap::LiteralTap(const LiteralConsumer& consumer) : consumer(consumer) {
+}
+
+// Pass the next chunk, the response lines are appended to lines
+void LiteralTap::feed(std::string_view data, std::string& lines) {
+    while (!data.empty()) {
+        if (literal_left > 0) {
+            std::string_view part = data.substr(0, literal_left);
+            data.remove_prefix(part.size());
+            literal_left -= part.size();
+            if (!stopped && !consumer(part)) {
+                stopped = true; // Skip everything that follows
+            }
+            continue;
+        }
+
+        size_t eol = data.find('\n');
+        line.append(data.substr(0, eol == std::string_view::npos ? data.size() : eol + 1));
+        if (eol == std::string_view::npos) {
+            return; // Wait for the rest of the line
+        }
+        data.remove_prefix(eol + 1);
+
+        lines.append(line);
+        literal_left = literal_length(line); // Check if a literal follows this line
+        line.clear();
+    }
+}
\ No newline at end of file
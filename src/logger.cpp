@@ -1,4 +1,7 @@
 #include "logger.hpp"
+#include "alloc_profiler.hpp"
+#include "perf_profiler.hpp"
+#include "trace.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -44,48 +47,60 @@ std::string get_current_timestamp() {
 
 // Logging functions
 void Logger::debug(const std::string& message) {
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_LOG); // Attribute allocations to logging
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_LOG); // Attribute CPU time as well
     std::lock_guard<std::mutex> lock(log_mutex); // Lock the mutex for thread safety
     if (current_log_level <= DEBUG) {
         std::string timestamp = get_current_timestamp();
         std::cout << CYAN << "[" << timestamp << "] [DEBUG] " << RESET << message << std::endl; // Log debug messages in cyan
 
         if(log_stream.is_open()) {
+            trace::Span span("log_flush"); // Writing with std::endl flushes the file
             log_stream << "[" << timestamp << "] [DEBUG] " << message << std::endl; // Log to file
         }
     }
 }
 
 void Logger::info(const std::string& message) {
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_LOG); // Attribute allocations to logging
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_LOG); // Attribute CPU time as well
     std::lock_guard<std::mutex> lock(log_mutex); // Lock the mutex for thread safety
     if (current_log_level <= INFO) {
         std::string timestamp = get_current_timestamp();
         std::cout << GREEN << "[" << timestamp << "] [INFO] " << RESET << message << std::endl; // Log info messages in green
 
         if(log_stream.is_open()) {
+            trace::Span span("log_flush"); // Writing with std::endl flushes the file
             log_stream << "[" << timestamp << "] [INFO] " << message << std::endl; // Log to file
         }
     }
 }
 
 void Logger::warning(const std::string& message) {
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_LOG); // Attribute allocations to logging
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_LOG); // Attribute CPU time as well
     std::lock_guard<std::mutex> lock(log_mutex); // Lock the mutex for thread safety
     if (current_log_level <= WARNING) {
         std::string timestamp = get_current_timestamp();
         std::cout << YELLOW << "[" << timestamp << "] [WARNING] " << RESET << message << std::endl; // Log warning messages in yellow
         
         if(log_stream.is_open()) {
+            trace::Span span("log_flush"); // Writing with std::endl flushes the file
             log_stream << "[" << timestamp << "] [WARNING] " << message << std::endl; // Log to file
         }
     }
 }
 
 void Logger::error(const std::string& message) {
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_LOG); // Attribute allocations to logging
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_LOG); // Attribute CPU time as well
     std::lock_guard<std::mutex> lock(log_mutex); // Lock the mutex for thread safety
     if (current_log_level <= LOG_ERROR) {
         std::string timestamp = get_current_timestamp();
         std::cerr << RED << "[" << timestamp << "] [ERROR] " << RESET << message << std::endl; // Log error messages in red
         
         if(log_stream.is_open()) {
+            trace::Span span("log_flush"); // Writing with std::endl flushes the file
             log_stream << "[" << timestamp << "] [ERROR] " << message << std::endl; // Log to file
         }
     }
@@ -1,5 +1,10 @@
 #include "daemon.hpp"
+#include "control.hpp"
 
-int main(){
-    run();
+int main(int argc, char* argv[]){
+    // With arguments this is a client of the running daemon, e.g. "TokenDaemon_console arm user@domain 60"
+    if (argc > 1) {
+        return control::run_client(std::vector<std::string>(argv + 1, argv + argc));
+    }
+    return run();
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "metrics.hpp"
+#include "logger.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+// Registry of all counters, ordered by name for a stable report.
+// Function-local statics, so counters can be looked up during static initialization.
+static std::map<std::string, std::unique_ptr<metrics::Counter>>& registry() {
+    static std::map<std::string, std::unique_ptr<metrics::Counter>> instance;
+    return instance;
+}
+
+static std::mutex& registry_mutex() {
+    static std::mutex instance; // Mutex for thread safety
+    return instance;
+}
+
+void metrics::Counter::add(uint64_t amount) {
+    value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+void metrics::Counter::set(uint64_t amount) {
+    value.store(amount, std::memory_order_relaxed);
+}
+
+void metrics::Counter::set_max(uint64_t amount) {
+    uint64_t current = value.load(std::memory_order_relaxed);
+    while (current < amount && !value.compare_exchange_weak(current, amount, std::memory_order_relaxed)) {
+        // current was reloaded, retry unless another thread stored a higher peak
+    }
+}
+
+uint64_t metrics::Counter::get() const {
+    return value.load(std::memory_order_relaxed);
+}
+
+metrics::Counter& metrics::counter(const std::string& name) {
+    std::lock_guard<std::mutex> lock(registry_mutex()); // Lock the registry
+    std::unique_ptr<metrics::Counter>& entry = registry()[name];
+    if (!entry) {
+        entry = std::make_unique<metrics::Counter>(); // Create the counter on first use
+    }
+    return *entry; // Counters are never removed, so the reference stays valid
+}
+
+void metrics::report() {
+    std::string report = "Metrics:";
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex()); // Lock the registry
+        for (const auto& [name, value] : registry()) {
+            report += "\n    " + name + " = " + std::to_string(value->get()); // One line per counter
+        }
+    }
+    Logger::logger().info(report); // Log outside of the registry lock
+}
\ No newline at end of file
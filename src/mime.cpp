@@ -0,0 +1,281 @@
+#include "mime.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+#include "alloc_profiler.hpp"
+#include "perf_profiler.hpp"
+
+#include <cctype>
+#include <algorithm>
+#include <stdexcept>
+
+// Node of a parsed BODYSTRUCTURE expression, either an atom/string or a list
+struct Node {
+    bool is_list = false; // True for parenthesized lists
+    bool is_nil = false; // True for NIL
+    std::string value; // Value of atoms and strings
+    std::vector<Node> children; // Elements of lists
+};
+
+// Lowercase copy of a string
+static std::string to_lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+    return value;
+}
+
+// Recursive descent parser for IMAP parenthesized expressions
+static Node parse_node(const std::string& input, size_t& pos) {
+    // Skip whitespace between elements
+    while (pos < input.size() && (input[pos] == ' ' || input[pos] == '\r' || input[pos] == '\n')) {
+        pos++;
+    }
+    if (pos >= input.size()) {
+        throw std::runtime_error("Unexpected end of BODYSTRUCTURE.");
+    }
+
+    Node node;
+    char c = input[pos];
+
+    if (c == '(') {
+        node.is_list = true;
+        pos++; // Skip the opening parenthesis
+        while (true) {
+            while (pos < input.size() && (input[pos] == ' ' || input[pos] == '\r' || input[pos] == '\n')) {
+                pos++;
+            }
+            if (pos >= input.size()) {
+                throw std::runtime_error("Unterminated list in BODYSTRUCTURE.");
+            }
+            if (input[pos] == ')') {
+                pos++; // Skip the closing parenthesis
+                break;
+            }
+            node.children.push_back(parse_node(input, pos)); // Parse the next element
+        }
+    } else if (c == '"') {
+        pos++; // Skip the opening quote
+        while (pos < input.size() && input[pos] != '"') {
+            if (input[pos] == '\\' && pos + 1 < input.size()) {
+                pos++; // Escaped character
+            }
+            node.value += input[pos++];
+        }
+        pos++; // Skip the closing quote
+    } else if (c == '{') {
+        // Literal string: {N}\r\n followed by N bytes
+        size_t close = input.find('}', pos);
+        if (close == std::string::npos) {
+            throw std::runtime_error("Malformed literal in BODYSTRUCTURE.");
+        }
+        size_t length = std::stoul(input.substr(pos + 1, close - pos - 1));
+        pos = close + 3; // Skip "}\r\n"
+        node.value = input.substr(pos, length);
+        pos += length;
+    } else {
+        // Atom (NIL or number)
+        size_t start = pos;
+        while (pos < input.size() && input[pos] != ' ' && input[pos] != '(' && input[pos] != ')' && input[pos] != '\r') {
+            pos++;
+        }
+        node.value = input.substr(start, pos - start);
+        node.is_nil = (to_lower(node.value) == "nil");
+    }
+
+    return node;
+}
+
+// Collects the leaf parts of a body node, numbering sections like IMAP does
+static void collect_parts(const Node& node, const std::string& section, std::vector<mime::BodyPart>& parts) {
+    if (!node.is_list || node.children.empty()) {
+        return;
+    }
+
+    // Multipart bodies start with the list of their children
+    if (node.children[0].is_list) {
+        int index = 1;
+        for (const Node& child : node.children) {
+            if (!child.is_list) {
+                break; // Subtype and extension data follow the children
+            }
+            std::string child_section = section.empty() ? std::to_string(index) : section + "." + std::to_string(index);
+            collect_parts(child, child_section, parts);
+            index++;
+        }
+        return;
+    }
+
+    // Single part: type subtype (params) id description encoding size ...
+    if (node.children.size() < 7) {
+        return; // Malformed part, ignore it
+    }
+
+    mime::BodyPart part;
+    part.section = section.empty() ? "1" : section; // A non-multipart message has a single part "1"
+    part.type = to_lower(node.children[0].value);
+    part.subtype = to_lower(node.children[1].value);
+    part.encoding = to_lower(node.children[5].value);
+
+    // Look for the charset in the parameter list
+    const Node& params = node.children[2];
+    for (size_t i = 0; params.is_list && i + 1 < params.children.size(); i += 2) {
+        if (to_lower(params.children[i].value) == "charset") {
+            part.charset = to_lower(params.children[i + 1].value);
+        }
+    }
+
+    try {
+        part.size = std::stoul(node.children[6].value);
+    } catch (const std::exception&) {
+        part.size = 0; // Unknown size
+    }
+
+    parts.push_back(part);
+}
+
+std::vector<mime::BodyPart> mime::parse_bodystructure(const std::string& response) {
+    std::vector<BodyPart> parts;
+
+    size_t pos = response.find("BODYSTRUCTURE ");
+    if (pos == std::string::npos) {
+        Logger::logger().error("No BODYSTRUCTURE found in response."); // Log error if the structure is missing
+        return parts;
+    }
+    pos += 14; // Skip "BODYSTRUCTURE "
+
+    try {
+        Node root = parse_node(response, pos); // Parse the whole structure
+        collect_parts(root, "", parts); // Flatten it into leaf parts
+    } catch (const std::exception& e) {
+        Logger::logger().error("Failed to parse BODYSTRUCTURE: " + std::string(e.what()));
+    }
+
+    return parts;
+}
+
+std::optional<mime::BodyPart> mime::select_text_part(const std::vector<BodyPart>& parts) {
+    // Tokens are usually formatted in the HTML part, the plain text part is the fallback
+    for (const char* subtype : {"html", "plain"}) {
+        for (const BodyPart& part : parts) {
+            if (part.type == "text" && part.subtype == subtype) {
+                return part;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+std::string mime::header_value(const std::string& header, const std::string& name) {
+    std::string wanted = to_lower(name) + ":";
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t eol = header.find('\n', pos);
+        if (eol == std::string::npos) {
+            eol = header.size();
+        }
+        if (to_lower(header.substr(pos, wanted.size())) != wanted) {
+            pos = eol + 1;
+            continue;
+        }
+
+        // Join continuation lines, they start with whitespace
+        std::string value = header.substr(pos + wanted.size(), eol - pos - wanted.size());
+        while (eol + 1 < header.size() && (header[eol + 1] == ' ' || header[eol + 1] == '\t')) {
+            size_t next = header.find('\n', eol + 1);
+            if (next == std::string::npos) {
+                next = header.size();
+            }
+            value += header.substr(eol + 1, next - eol - 1);
+            eol = next;
+        }
+        std::replace(value.begin(), value.end(), '\r', ' ');
+        size_t start = value.find_first_not_of(" \t");
+        size_t end = value.find_last_not_of(" \t");
+        return start == std::string::npos ? "" : value.substr(start, end - start + 1);
+    }
+    return "";
+}
+
+std::string mime::decode_header_words(const std::string& value) {
+    std::string result;
+    size_t pos = 0;
+    size_t gap = std::string::npos; // Start of the whitespace after the last encoded word, dropped between two of them
+    while (pos < value.size()) {
+        size_t open = value.find("=?", pos);
+        if (open == std::string::npos) {
+            break;
+        }
+
+        // "=?charset?encoding?text?="
+        size_t charset_end = value.find('?', open + 2);
+        size_t encoding_end = charset_end == std::string::npos ? std::string::npos : value.find('?', charset_end + 1);
+        size_t close = encoding_end == std::string::npos ? std::string::npos : value.find("?=", encoding_end + 1);
+        if (close == std::string::npos || encoding_end != charset_end + 2) {
+            break; // Not an encoded word, keep the rest as it is
+        }
+
+        std::string between = value.substr(pos, open - pos);
+        if (gap != pos || between.find_first_not_of(" \t") != std::string::npos) {
+            result += between;
+        }
+
+        std::string charset = to_lower(value.substr(open + 2, charset_end - open - 2));
+        charset = charset.substr(0, charset.find('*')); // Drop the RFC 2231 language
+        char encoding = static_cast<char>(std::toupper(static_cast<unsigned char>(value[charset_end + 1])));
+        std::string text = value.substr(encoding_end + 1, close - encoding_end - 1);
+        if (encoding == 'B') {
+            text = base64::decode(text);
+        } else {
+            std::replace(text.begin(), text.end(), '_', ' '); // Q encoding writes spaces as underscores
+            text = quoted_printable::decode(text);
+        }
+        result += utf8::from_charset(text, charset);
+
+        pos = close + 2;
+        gap = pos;
+    }
+    return result + value.substr(std::min(pos, value.size()));
+}
+
+mime::TransferDecoder::TransferDecoder(const std::string& encoding, const std::string& charset)
+    : encoding(encoding), charset(charset), multibyte(charset.empty() || charset == "utf-8" || charset == "utf8" || charset == "us-ascii") {
+}
+
+std::string mime::TransferDecoder::feed(std::string_view chunk) {
+    alloc_profiler::ScopedStage stage(alloc_profiler::STAGE_DECODE); // Attribute allocations to decoding
+    perf_profiler::ScopedStage cpu_stage(perf_profiler::STAGE_DECODE); // Attribute CPU time as well
+    std::string decoded;
+    if (encoding == "base64") {
+        for (char c : chunk) {
+            if (c != '\r' && c != '\n' && c != ' ' && c != '\t') {
+                pending += c;
+            }
+        }
+        size_t usable = pending.size() - pending.size() % 4; // Only whole quads
+        decoded = base64::decode(pending.substr(0, usable));
+        pending.erase(0, usable);
+    } else if (encoding == "quoted-printable") {
+        pending.append(chunk);
+        // Hold back an escape or soft line break that is not complete yet ("=", "=4", "=\r", "= \t", "= \r"),
+        // whitespace after '=' is only known to be a soft line break once the line ends
+        size_t usable = pending.size();
+        size_t escape = pending.rfind('=');
+        if (escape != std::string::npos) {
+            size_t after = pending.find_first_not_of(" \t", escape + 1);
+            if (escape + 2 >= pending.size() || after == std::string::npos || (pending[after] == '\r' && after + 1 == pending.size())) {
+                usable = escape;
+            }
+        }
+        decoded = quoted_printable::decode(pending.substr(0, usable));
+        pending.erase(0, usable);
+    } else {
+        decoded.assign(chunk); // 7bit, 8bit and binary need no decoding
+    }
+
+    if (!multibyte) {
+        return utf8::from_charset(decoded, charset); // Single-byte charsets are never split
+    }
+    decoded.insert(0, tail);
+    size_t cut = utf8::incomplete_tail(decoded);
+    tail = decoded.substr(decoded.size() - cut);
+    decoded.resize(decoded.size() - cut);
+    return utf8::from_charset(decoded, charset);
+}
@@ -0,0 +1,495 @@
+#ifdef __linux__
+
+#include "os.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string>
+#include <optional>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+extern char** environ;
+
+namespace {
+    int shutdown_fd = -1; // eventfd that is never read, stays readable once shutdown_flag is requested
+    int signal_fd = -1; // signalfd for SIGTERM, SIGINT, SIGHUP and SIGUSR1
+    std::atomic<bool> shutdown_flag = false; // Set by request_shutdown()
+    std::mutex waiters_mutex; // Guards wake_fds
+    std::vector<int> wake_fds; // eventfd of every thread that ever waited
+    std::atomic<uint64_t> wake_count = 0; // Calls of wake_all(), incremented before the waiters are woken
+
+    // epoll loop of a thread, created on its first wait
+    class Waiter {
+    public:
+        int epoll_fd = -1;
+        int timer_fd = -1; // timerfd armed with the wait time
+        int wake_fd = -1; // eventfd written by wake_all()
+        bool signals = false; // signal_fd was added to the loop
+
+        Waiter() {
+            epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+            wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            add(timer_fd);
+            add(wake_fd);
+            add(shutdown_fd);
+
+            std::lock_guard<std::mutex> lock(waiters_mutex);
+            wake_fds.push_back(wake_fd);
+        }
+
+        ~Waiter() {
+            {
+                std::lock_guard<std::mutex> lock(waiters_mutex);
+                wake_fds.erase(std::remove(wake_fds.begin(), wake_fds.end(), wake_fd), wake_fds.end());
+            }
+            close(wake_fd);
+            close(timer_fd);
+            close(epoll_fd);
+        }
+
+        void add(int fd) {
+            if (fd < 0) {
+                return;
+            }
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        }
+    };
+
+    Waiter& waiter() {
+        thread_local Waiter waiter;
+        return waiter;
+    }
+
+    // Runs a command without a shell, optionally writing input to its stdin or reading its stdout.
+    // Fails if the command exits before it has read all of the input (EPIPE).
+    bool run_command(std::vector<std::string> args, const std::string* input, std::string* output) {
+        int pipe_fds[2];
+        if ((input || output) && pipe2(pipe_fds, O_CLOEXEC) != 0) {
+            return false;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (input) {
+            posix_spawn_file_actions_adddup2(&actions, pipe_fds[0], STDIN_FILENO);
+        } else if (output) {
+            posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+        }
+
+        // The daemon blocks its signals and ignores SIGPIPE, the command starts with the defaults
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+        sigset_t signals;
+        sigemptyset(&signals);
+        posix_spawnattr_setsigmask(&attributes, &signals);
+        sigaddset(&signals, SIGPIPE);
+        posix_spawnattr_setsigdefault(&attributes, &signals);
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+        std::vector<char*> argv;
+        for (std::string& arg : args) {
+            argv.push_back(arg.data());
+        }
+        argv.push_back(nullptr);
+
+        pid_t pid;
+        int rc = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attributes);
+
+        if (input || output) {
+            close(input ? pipe_fds[0] : pipe_fds[1]);
+        }
+        if (rc != 0) {
+            if (input || output) {
+                close(input ? pipe_fds[1] : pipe_fds[0]);
+            }
+            return false;
+        }
+
+        bool written = true;
+        if (input) {
+            const char* data = input->data();
+            size_t left = input->size();
+            while (left > 0) {
+                ssize_t n = write(pipe_fds[1], data, left);
+                if (n <= 0 && errno != EINTR) {
+                    written = false; // EPIPE: the command exited without reading everything
+                    break;
+                }
+                if (n > 0) {
+                    data += n;
+                    left -= n;
+                }
+            }
+            close(pipe_fds[1]);
+        } else if (output) {
+            char buffer[4096];
+            ssize_t n;
+            while ((n = read(pipe_fds[0], buffer, sizeof(buffer))) != 0) {
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                output->append(buffer, n);
+            }
+            close(pipe_fds[0]);
+        }
+
+        int status = 0;
+        pid_t waited;
+        while ((waited = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {}
+        return written && waited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0; // status is unset if waitpid failed
+    }
+
+    // Address of a local socket, false if the path does not fit
+    bool local_address(const std::string& path, sockaddr_un& address) {
+        address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    // Reads until the peer closes its side, the limit is reached or (for requests) the line ends
+    std::string read_all(int fd, size_t limit, bool line = false) {
+        std::string data;
+        char buffer[1024];
+        ssize_t n;
+        while (data.size() < limit && !(line && data.find('\n') != std::string::npos) && (n = read(fd, buffer, sizeof(buffer))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            data.append(buffer, n);
+        }
+        return data;
+    }
+
+    // Writes all data to a socket, a peer that went away fails the send instead of raising SIGPIPE
+    bool send_all(int fd, const std::string& data) {
+        size_t offset = 0;
+        while (offset < data.size()) {
+            ssize_t n = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            offset += n;
+        }
+        return true;
+    }
+
+    // Clipboard tool of the running session, Wayland or X11
+    std::vector<std::string> clipboard_command(bool write) {
+        if (std::getenv("WAYLAND_DISPLAY")) {
+            return write ? std::vector<std::string>{"wl-copy"} : std::vector<std::string>{"wl-paste", "--no-newline"};
+        }
+        return {"xclip", "-selection", "clipboard", write ? "-i" : "-o"};
+    }
+}
+
+std::optional<std::string> os::copy_to_clipboard(const std::string& data){
+    trace::Span span("copy_to_clipboard");
+
+    std::string clip_text;
+    if (!run_command(clipboard_command(false), nullptr, &clip_text)) {
+        clip_text.clear(); // An empty clipboard is not an error, restoring it clears the token
+    }
+    Logger::logger().debug("Read clipboard.");
+
+    if (!run_command(clipboard_command(true), &data, nullptr)) {
+        Logger::logger().error("Failed to write clipboard with " + clipboard_command(true).front() + ".");
+        return std::nullopt;
+    }
+
+    Logger::logger().info("Data copied to clipboard.");
+    return std::optional<std::string>(clip_text);
+}
+
+bool os::init(){
+    // Signals are only delivered through signal_fd, so they must be blocked before any thread starts
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) {
+        Logger::logger().error("Failed to block signals.");
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN); // A reader that exits early (control client, clipboard tool) fails the write instead
+
+    signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    shutdown_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (signal_fd < 0 || shutdown_fd < 0) {
+        Logger::logger().error("Failed to create the event descriptors.");
+        return false;
+    }
+    return true;
+}
+
+void os::set_env(const std::string& name, const std::string& value) {
+    setenv(name.c_str(), value.c_str(), 1);
+    if (name == "TZ") {
+        tzset(); // Apply the new timezone to the time functions
+    }
+}
+
+os::WaitResult os::wait(long milliseconds, bool signals) {
+    if (shutdown_flag) {
+        return WAIT_SHUTDOWN;
+    }
+
+    Waiter& w = waiter();
+    if (signals && !w.signals) {
+        w.add(signal_fd); // Only the signal waiter reads signal_fd
+        w.signals = true;
+    }
+
+    // Arm the timer, a zero value would disarm it
+    itimerspec timer{};
+    long wait_ms = std::max(milliseconds, 1L);
+    timer.it_value.tv_sec = wait_ms / 1000;
+    timer.it_value.tv_nsec = (wait_ms % 1000) * 1000000L;
+    timerfd_settime(w.timer_fd, 0, &timer, nullptr);
+
+    WaitResult result = WAIT_TIMEOUT;
+    bool done = false;
+    while (!done) {
+        epoll_event events[4];
+        int count = epoll_wait(w.epoll_fd, events, 4, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break; // The loop is broken, do not spin
+        }
+
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            uint64_t value;
+
+            if (fd == shutdown_fd) {
+                result = WAIT_SHUTDOWN; // Never read, so every thread sees it
+                done = true;
+            } else if (fd == signal_fd) {
+                signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                    if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT) {
+                        Logger::logger().info("Received shutdown signal.");
+                        request_shutdown();
+                        result = WAIT_SHUTDOWN;
+                    } else if (result != WAIT_SHUTDOWN) {
+                        result = info.ssi_signo == SIGHUP ? WAIT_RELOAD : WAIT_REPORT;
+                    }
+                }
+                done = true;
+            } else if (fd == w.wake_fd) {
+                if (read(w.wake_fd, &value, sizeof(value)) == sizeof(value) && result == WAIT_TIMEOUT) {
+                    result = WAIT_WAKE;
+                }
+                done = true;
+            } else if (fd == w.timer_fd) {
+                if (read(w.timer_fd, &value, sizeof(value)) == sizeof(value)) {
+                    done = true;
+                }
+            }
+        }
+    }
+
+    timer = {};
+    timerfd_settime(w.timer_fd, 0, &timer, nullptr); // Disarm, so an early return leaves no stale expiry
+    return result;
+}
+
+void os::wake_all() {
+    std::lock_guard<std::mutex> lock(waiters_mutex);
+    wake_count++;
+    uint64_t one = 1;
+    for (int fd : wake_fds) {
+        if (write(fd, &one, sizeof(one)) < 0) {
+            Logger::logger().debug("Failed to wake a waiting thread.");
+        }
+    }
+}
+
+uint64_t os::wakes() {
+    return wake_count;
+}
+
+void os::request_shutdown() {
+    shutdown_flag = true;
+    uint64_t one = 1;
+    if (shutdown_fd >= 0 && write(shutdown_fd, &one, sizeof(one)) < 0) {
+        Logger::logger().error("Failed to signal shutdown.");
+    }
+}
+
+bool os::shutdown_requested() {
+    return shutdown_flag;
+}
+
+bool os::serve_local(const std::string& path, const std::function<std::string(const std::string&)>& handle) {
+    sockaddr_un address;
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 || !local_address(path, address)) {
+        Logger::logger().error("Failed to create the control socket " + path + ".");
+        if (listener >= 0) {
+            close(listener);
+        }
+        return false;
+    }
+
+    unlink(path.c_str()); // Left behind by a daemon that was killed
+    mode_t mask = umask(0177); // The socket is created with 0600, there is no moment another user could connect
+    int bound = bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    umask(mask);
+    if (bound != 0 || listen(listener, 4) != 0) {
+        Logger::logger().error("Failed to listen on " + path + ": " + std::string(std::strerror(errno)));
+        close(listener);
+        return false;
+    }
+    Logger::logger().info("Listening for control requests on " + path + ".");
+
+    while (!shutdown_flag) {
+        pollfd fds[2] = {{listener, POLLIN, 0}, {shutdown_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            continue;
+        }
+        timeval limit = {1, 0}; // A stuck client must not block the next one
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof(limit));
+
+        std::string request = read_all(client, 1024, true);
+        request = request.substr(0, request.find_first_of("\r\n"));
+        send_all(client, handle(request));
+        close(client);
+    }
+
+    close(listener);
+    unlink(path.c_str());
+    return true;
+}
+
+std::optional<std::string> os::request_local(const std::string& path, const std::string& request) {
+    sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || !local_address(path, address) || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return std::nullopt;
+    }
+
+    send_all(fd, request + "\n");
+    ::shutdown(fd, SHUT_WR); // End of the request
+    std::string response = read_all(fd, 1 << 20);
+    close(fd);
+    return response;
+}
+
+os::MappedFile::MappedFile(const std::string& path) {
+    file = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600); // Only the user may read the tokens
+    struct stat info;
+    if (file < 0 || fstat(file, &info) != 0) {
+        if (file >= 0) {
+            close(file);
+        }
+        throw std::runtime_error("Failed to open " + path + ": " + std::string(std::strerror(errno)));
+    }
+    length = info.st_size;
+    map();
+}
+
+os::MappedFile::~MappedFile() {
+    unmap();
+    close(file);
+}
+
+void os::MappedFile::map() {
+    if (length == 0) {
+        return; // Nothing to map in a new file
+    }
+    void* address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (address == MAP_FAILED) {
+        throw std::runtime_error("Failed to map file: " + std::string(std::strerror(errno)));
+    }
+    view = static_cast<char*>(address);
+}
+
+void os::MappedFile::unmap() {
+    if (view) {
+        munmap(view, length);
+        view = nullptr;
+    }
+}
+
+void os::MappedFile::resize(size_t size) {
+    if (ftruncate(file, size) != 0) {
+        throw std::runtime_error("Failed to grow file: " + std::string(std::strerror(errno)));
+    }
+    unmap();
+    length = size;
+    map();
+}
+
+bool os::MappedFile::sync() {
+    // Dirty pages of a shared mapping live in the page cache of the file, so this
+    // does not touch the mapping and cannot race with writers
+    return fdatasync(file) == 0;
+}
+
+void os::notify(const std::string& message, int delay) {
+    // Desktop notification through the session's notification daemon
+    if (!run_command({"notify-send", "-t", std::to_string(delay * 1000), "Notification", message}, nullptr, nullptr)) {
+        Logger::logger().warning("notify-send failed: " + message);
+    }
+}
+
+#endif
\ No newline at end of file
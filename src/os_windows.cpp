@@ -0,0 +1,342 @@
+#ifdef _WIN32
+
+#include "os.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+
+#include <winsock2.h> // Before windows.h, which pulls in the old winsock
+#include <afunix.h>
+#include <windows.h>
+#include <shellapi.h>
+#include <sddl.h>
+#include <string>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <cstring>
+
+namespace {
+    std::mutex wait_mutex; // Guards the wait state below
+    std::condition_variable wait_cv; // Signalled on every wake, signal and shutdown
+    uint64_t wake_generation = 0; // Incremented by wake_all()
+    bool shutdown_flag = false;
+    os::WaitResult pending_signal = os::WAIT_TIMEOUT; // Console event not yet handled by the signal waiter
+    thread_local uint64_t seen_generation = 0; // Last wake handled by this thread
+    thread_local bool seen_seeded = false; // seen_generation was taken from wake_generation, wakes before the first wait do not count
+
+    // Console events arrive on their own thread, so they can notify the waiters directly
+    BOOL WINAPI console_handler(DWORD event) {
+        if (event == CTRL_BREAK_EVENT) {
+            std::lock_guard<std::mutex> lock(wait_mutex);
+            pending_signal = os::WAIT_REPORT;
+            wait_cv.notify_all();
+            return TRUE;
+        }
+        if (event == CTRL_C_EVENT || event == CTRL_CLOSE_EVENT || event == CTRL_SHUTDOWN_EVENT) {
+            os::request_shutdown();
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    // Address of a local socket, false if the path does not fit
+    bool local_address(const std::string& path, sockaddr_un& address) {
+        address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    // Reads until the peer closes its side, the limit is reached or (for requests) the line ends
+    std::string read_all(SOCKET socket, size_t limit, bool line = false) {
+        std::string data;
+        char buffer[1024];
+        int n;
+        while (data.size() < limit && !(line && data.find('\n') != std::string::npos) && (n = recv(socket, buffer, sizeof(buffer), 0)) > 0) {
+            data.append(buffer, n);
+        }
+        return data;
+    }
+
+    bool send_all(SOCKET socket, const std::string& data) {
+        size_t offset = 0;
+        while (offset < data.size()) {
+            int n = send(socket, data.data() + offset, static_cast<int>(data.size() - offset), 0);
+            if (n <= 0) {
+                return false;
+            }
+            offset += n;
+        }
+        return true;
+    }
+
+    bool start_winsock() {
+        static const bool started = [] {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+        return started;
+    }
+}
+
+std::optional<std::string> os::copy_to_clipboard(const std::string& data){
+    trace::Span span("copy_to_clipboard");
+
+    // Create a hidden window to act as the clipboard owner
+    HWND hWnd = CreateWindowEx(
+        0, "STATIC", "HiddenWindow", 0, 0, 0, 0, 0,
+        HWND_MESSAGE, nullptr, nullptr, nullptr);
+    if (!hWnd) {
+        Logger::logger().error("Failed to create hidden window for clipboard operations.");
+        return std::nullopt;
+    }
+
+    while(!OpenClipboard(hWnd)) Sleep(1);
+    Logger::logger().debug("Opened clipboard.");
+
+    HANDLE cmem = GetClipboardData(CF_TEXT);
+    if (cmem == nullptr) {
+        CloseClipboard();
+        DestroyWindow(hWnd);
+        return std::nullopt;
+    }
+
+    char* pchData = static_cast<char*>(GlobalLock(cmem));
+    if (pchData == nullptr) {
+        CloseClipboard();
+        DestroyWindow(hWnd);
+        return std::nullopt;
+    }
+
+    std::string clip_text(pchData);
+    GlobalUnlock(cmem);
+
+    HGLOBAL hMem =  GlobalAlloc(GMEM_MOVEABLE, data.length() + 1);
+    if (hMem == nullptr) {
+        CloseClipboard();
+        DestroyWindow(hWnd);
+        return std::nullopt;
+    }
+
+    void* pMem = GlobalLock(hMem);
+    if (pMem == nullptr) {
+        GlobalFree(hMem);
+        CloseClipboard();
+        DestroyWindow(hWnd);
+        return std::nullopt;
+    }
+
+    memcpy(pMem, data.c_str(), data.length() + 1);
+    GlobalUnlock(hMem);
+    EmptyClipboard();
+    if(!SetClipboardData(CF_TEXT, hMem)) {
+        GlobalFree(hMem);
+        CloseClipboard();
+        DestroyWindow(hWnd);
+        return std::nullopt;
+    }
+
+    // SetClipboardData will take ownership of hMem, so we don't free it here
+    CloseClipboard();
+    DestroyWindow(hWnd);
+
+    Logger::logger().info("Data copied to clipboard.");
+    return std::optional<std::string>(clip_text);
+}
+
+bool os::init(){
+    return SetConsoleCtrlHandler(console_handler, TRUE);
+}
+
+void os::set_env(const std::string& name, const std::string& value) {
+    _putenv((name + "=" + value).c_str());
+}
+
+os::WaitResult os::wait(long milliseconds, bool signals) {
+    std::unique_lock<std::mutex> lock(wait_mutex);
+    if (!seen_seeded) {
+        seen_generation = wake_generation; // Like on Linux, a thread only sees wakes from its first wait on
+        seen_seeded = true;
+    }
+    wait_cv.wait_for(lock, std::chrono::milliseconds(milliseconds), [signals]() {
+        return shutdown_flag || seen_generation != wake_generation || (signals && pending_signal != WAIT_TIMEOUT);
+    });
+
+    if (shutdown_flag) {
+        return WAIT_SHUTDOWN;
+    }
+    if (signals && pending_signal != WAIT_TIMEOUT) {
+        WaitResult result = pending_signal;
+        pending_signal = WAIT_TIMEOUT;
+        return result;
+    }
+    if (seen_generation != wake_generation) {
+        seen_generation = wake_generation;
+        return WAIT_WAKE;
+    }
+    return WAIT_TIMEOUT;
+}
+
+void os::wake_all() {
+    std::lock_guard<std::mutex> lock(wait_mutex);
+    wake_generation++;
+    wait_cv.notify_all();
+}
+
+uint64_t os::wakes() {
+    std::lock_guard<std::mutex> lock(wait_mutex);
+    return wake_generation;
+}
+
+void os::request_shutdown() {
+    std::lock_guard<std::mutex> lock(wait_mutex);
+    shutdown_flag = true;
+    wait_cv.notify_all();
+}
+
+bool os::shutdown_requested() {
+    std::lock_guard<std::mutex> lock(wait_mutex);
+    return shutdown_flag;
+}
+
+bool os::serve_local(const std::string& path, const std::function<std::string(const std::string&)>& handle) {
+    sockaddr_un address;
+    SOCKET listener = start_winsock() ? socket(AF_UNIX, SOCK_STREAM, 0) : INVALID_SOCKET;
+    if (listener == INVALID_SOCKET || !local_address(path, address)) {
+        Logger::logger().error("Failed to create the control socket " + path + ".");
+        if (listener != INVALID_SOCKET) {
+            closesocket(listener);
+        }
+        return false;
+    }
+
+    DeleteFileA(path.c_str()); // Left behind by a daemon that was killed
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 4) != 0) {
+        Logger::logger().error("Failed to listen on " + path + ": error " + std::to_string(WSAGetLastError()));
+        closesocket(listener);
+        return false;
+    }
+    Logger::logger().info("Listening for control requests on " + path + ".");
+
+    while (!shutdown_requested()) {
+        WSAPOLLFD fd = {listener, POLLRDNORM, 0};
+        if (WSAPoll(&fd, 1, 500) <= 0) { // Shutdown cannot wake WSAPoll, check it twice a second
+            continue;
+        }
+
+        SOCKET client = accept(listener, nullptr, nullptr);
+        if (client == INVALID_SOCKET) {
+            continue;
+        }
+        DWORD limit = 1000; // A stuck client must not block the next one
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&limit), sizeof(limit));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&limit), sizeof(limit));
+
+        std::string request = read_all(client, 1024, true);
+        request = request.substr(0, request.find_first_of("\r\n"));
+        send_all(client, handle(request));
+        closesocket(client);
+    }
+
+    closesocket(listener);
+    DeleteFileA(path.c_str());
+    return true;
+}
+
+std::optional<std::string> os::request_local(const std::string& path, const std::string& request) {
+    sockaddr_un address;
+    SOCKET fd = start_winsock() ? socket(AF_UNIX, SOCK_STREAM, 0) : INVALID_SOCKET;
+    if (fd == INVALID_SOCKET || !local_address(path, address) || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        if (fd != INVALID_SOCKET) {
+            closesocket(fd);
+        }
+        return std::nullopt;
+    }
+
+    send_all(fd, request + "\n");
+    ::shutdown(fd, SD_SEND); // End of the request
+    std::string response = read_all(fd, 1 << 20);
+    closesocket(fd);
+    return response;
+}
+
+os::MappedFile::MappedFile(const std::string& path) {
+    // Only the owner and the system may access a new file, like 0600 on Linux, it holds tokens
+    SECURITY_ATTRIBUTES security = {sizeof(SECURITY_ATTRIBUTES), nullptr, FALSE};
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorA("D:P(A;;FA;;;OW)(A;;FA;;;SY)", SDDL_REVISION_1, &security.lpSecurityDescriptor, nullptr)) {
+        throw std::runtime_error("Failed to create the security descriptor for " + path + ": error " + std::to_string(GetLastError()));
+    }
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, &security, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    DWORD error = GetLastError();
+    LocalFree(security.lpSecurityDescriptor);
+    LARGE_INTEGER size;
+    if (handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(handle, &size)) {
+        if (handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle);
+        }
+        throw std::runtime_error("Failed to open " + path + ": error " + std::to_string(handle == INVALID_HANDLE_VALUE ? error : GetLastError()));
+    }
+    file = reinterpret_cast<std::intptr_t>(handle);
+    length = static_cast<size_t>(size.QuadPart);
+    map();
+}
+
+os::MappedFile::~MappedFile() {
+    unmap();
+    CloseHandle(reinterpret_cast<HANDLE>(file));
+}
+
+void os::MappedFile::map() {
+    if (length == 0) {
+        return; // A mapping of an empty file is not allowed
+    }
+    HANDLE handle = CreateFileMappingA(reinterpret_cast<HANDLE>(file), nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    void* address = handle ? MapViewOfFile(handle, FILE_MAP_WRITE, 0, 0, length) : nullptr;
+    if (!address) {
+        if (handle) {
+            CloseHandle(handle);
+        }
+        throw std::runtime_error("Failed to map file: error " + std::to_string(GetLastError()));
+    }
+    mapping = reinterpret_cast<std::intptr_t>(handle);
+    view = static_cast<char*>(address);
+}
+
+void os::MappedFile::unmap() {
+    if (view) {
+        UnmapViewOfFile(view);
+        CloseHandle(reinterpret_cast<HANDLE>(mapping));
+        view = nullptr;
+        mapping = 0;
+    }
+}
+
+void os::MappedFile::resize(size_t size) {
+    unmap(); // The file cannot grow while it is mapped
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(size);
+    if (!SetFilePointerEx(reinterpret_cast<HANDLE>(file), end, nullptr, FILE_BEGIN) || !SetEndOfFile(reinterpret_cast<HANDLE>(file))) {
+        map(); // Keep the old mapping usable
+        throw std::runtime_error("Failed to grow file: error " + std::to_string(GetLastError()));
+    }
+    length = size;
+    map();
+}
+
+bool os::MappedFile::sync() {
+    // Flushing the view only starts the writes, FlushFileBuffers waits for them
+    return FlushViewOfFile(view, 0) && FlushFileBuffers(reinterpret_cast<HANDLE>(file));
+}
+
+void os::notify(const std::string& message, int delay) {
+    MessageBox(nullptr, message.c_str(), "Notification", MB_OK);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,220 @@
+#include "perf_profiler.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+
+#if PERF_PROFILING && defined(__linux__)
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    // Counter read for every stage, task-clock leads the group because it is available everywhere
+    struct CounterSpec {
+        uint32_t type;
+        uint64_t config;
+        const char* name;
+    };
+
+    constexpr CounterSpec counter_specs[] = {
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task_clock_ns"},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache_misses"},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context_switches"},
+    };
+    constexpr size_t COUNTER_COUNT = sizeof(counter_specs) / sizeof(counter_specs[0]);
+
+    const char* stage_names[perf_profiler::STAGE_COUNT] = {"other", "network", "decode", "extract", "log"};
+
+    std::atomic<bool> enabled{false}; // Counting between start() and stop()
+    std::atomic<uint64_t> session{0}; // Incremented by start(), older readings are not charged
+    std::atomic<int> open_threads{0}; // Threads that still hold counters
+    std::atomic<bool> available[COUNTER_COUNT]; // Counter could be opened on at least one thread
+    std::atomic<uint64_t> totals[perf_profiler::STAGE_COUNT][COUNTER_COUNT]; // Counts per stage
+
+    // Counters of one thread
+    struct ThreadCounters {
+        int fds[COUNTER_COUNT]; // File descriptors, -1 if the counter is not available
+        int leader = -1; // Group leader, -1 if not opened
+        bool failed = false; // Opening the leader failed, do not retry
+        uint64_t last[COUNTER_COUNT] = {}; // Values at the last stage change
+        uint64_t last_session = 0; // Session of the last values
+        perf_profiler::Stage stage = perf_profiler::STAGE_OTHER; // Stage the thread is in
+
+        ThreadCounters() {
+            std::fill(std::begin(fds), std::end(fds), -1);
+        }
+
+        ~ThreadCounters() {
+            close_all();
+        }
+
+        bool open() {
+            for (size_t i = 0; i < COUNTER_COUNT; i++) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = counter_specs[i].type;
+                attr.config = counter_specs[i].config;
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.exclude_hv = 1;
+
+                // This thread on any CPU. Context switches happen in the kernel, so try with kernel counting first,
+                // without privileges (perf_event_paranoid 2) only user space may be counted.
+                fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+                if (fds[i] < 0) {
+                    attr.exclude_kernel = 1;
+                    fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+                }
+                if (i == 0 && fds[i] < 0) {
+                    failed = true;
+                    return false;
+                }
+                if (i == 0) {
+                    leader = fds[0];
+                }
+                if (fds[i] >= 0) {
+                    available[i].store(true, std::memory_order_relaxed);
+                }
+            }
+            open_threads.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        void close_all() {
+            if (leader < 0) {
+                return;
+            }
+            for (int& fd : fds) {
+                if (fd >= 0) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+            leader = -1;
+            open_threads.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // Reads the whole group at once, the values come in the order the members were opened
+        bool read_all(uint64_t (&values)[COUNTER_COUNT]) {
+            uint64_t buffer[1 + COUNTER_COUNT];
+            if (::read(leader, buffer, sizeof(buffer)) < static_cast<ssize_t>(sizeof(uint64_t))) {
+                return false;
+            }
+            size_t next = 1;
+            for (size_t i = 0; i < COUNTER_COUNT; i++) {
+                values[i] = fds[i] >= 0 && next <= buffer[0] ? buffer[next++] : 0;
+            }
+            return true;
+        }
+
+        // Charges the counts since the last change to the current stage and switches to the new one
+        void change(perf_profiler::Stage next) {
+            if (leader < 0 && (failed || !open())) {
+                stage = next;
+                return;
+            }
+
+            uint64_t values[COUNTER_COUNT];
+            if (read_all(values)) {
+                uint64_t current_session = session.load(std::memory_order_relaxed);
+                if (last_session == current_session) {
+                    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+                        totals[stage][i].fetch_add(values[i] - last[i], std::memory_order_relaxed);
+                    }
+                }
+                std::copy(std::begin(values), std::end(values), std::begin(last));
+                last_session = current_session;
+            }
+            stage = next;
+        }
+    };
+
+    thread_local ThreadCounters thread_counters;
+}
+
+perf_profiler::ScopedStage::ScopedStage(Stage stage) : previous(STAGE_OTHER), counting(enabled.load(std::memory_order_relaxed)) {
+    if (!counting) {
+        if (open_threads.load(std::memory_order_relaxed) > 0) {
+            thread_counters.close_all(); // Give the counters back after a session
+        }
+        return;
+    }
+    previous = thread_counters.stage;
+    thread_counters.change(stage);
+}
+
+perf_profiler::ScopedStage::~ScopedStage() {
+    if (counting && enabled.load(std::memory_order_relaxed)) {
+        thread_counters.change(previous);
+    }
+}
+
+bool perf_profiler::start() {
+    for (auto& stage : totals) {
+        for (auto& total : stage) {
+            total.store(0, std::memory_order_relaxed);
+        }
+    }
+    session.fetch_add(1, std::memory_order_relaxed); // Readings of an earlier session are not charged
+
+    // Try on this thread first, so an unsupported kernel is reported right away
+    thread_counters.failed = false;
+    if (thread_counters.leader < 0 && !thread_counters.open()) {
+        Logger::logger().error("perf_event_open failed: " + std::string(std::strerror(errno)) + ".");
+        return false;
+    }
+    enabled.store(true, std::memory_order_relaxed);
+    Logger::logger().info("CPU profiling started.");
+    return true;
+}
+
+void perf_profiler::stop() {
+    if (enabled.exchange(false, std::memory_order_relaxed)) {
+        Logger::logger().info("CPU profiling stopped.");
+    }
+}
+
+std::string perf_profiler::report() {
+    std::string report = "CPU profile per stage:";
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        report += "\n    " + std::string(stage_names[stage]) + ":";
+        uint64_t values[COUNTER_COUNT];
+        for (size_t i = 0; i < COUNTER_COUNT; i++) {
+            values[i] = totals[stage][i].load(std::memory_order_relaxed);
+            if (!available[i].load(std::memory_order_relaxed)) {
+                continue; // Not supported here (e.g. no PMU in a VM)
+            }
+            report += " " + std::string(counter_specs[i].name) + " " + std::to_string(values[i]);
+            metrics::counter("perf." + std::string(stage_names[stage]) + "." + counter_specs[i].name).set(values[i]);
+        }
+        if (values[1] > 0) {
+            report += " ipc " + std::to_string(static_cast<double>(values[2]) / static_cast<double>(values[1])).substr(0, 4);
+        }
+    }
+    return report;
+}
+
+#else
+
+bool perf_profiler::start() {
+    Logger::logger().warning("CPU profiling is not available, build with PERF_PROFILING on Linux.");
+    return false;
+}
+
+void perf_profiler::stop() {
+}
+
+std::string perf_profiler::report() {
+    return "CPU profiling is not available.";
+}
+
+#endif
\ No newline at end of file
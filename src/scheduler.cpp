@@ -0,0 +1,70 @@
+#include "scheduler.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Number of latency samples kept for the percentiles
+static constexpr size_t MAX_LATENCY_SAMPLES = 1024;
+
+// Constructor
+PollScheduler::PollScheduler(long min_interval, long max_interval, double backoff, double jitter, long hot_window)
+    : min_interval(min_interval), max_interval(std::max(min_interval, max_interval)), backoff(backoff), jitter(jitter), hot_window(hot_window),
+      current(min_interval), last_activity(clock::now()), rng(std::random_device{}()), start(clock::now()) {
+}
+
+void PollScheduler::on_poll(bool found) {
+    wakeups++; // Count every poll as a wakeup
+
+    if (found) {
+        on_activity(); // New mail means more may follow soon
+    } else {
+        current = std::min(current * backoff, static_cast<double>(max_interval)); // Back off after an empty poll
+    }
+}
+
+void PollScheduler::on_activity() {
+    last_activity = clock::now();
+    current = min_interval; // Poll fast again
+}
+
+void PollScheduler::record_latency(long milliseconds) {
+    latencies.push_back(milliseconds);
+    if (latencies.size() > MAX_LATENCY_SAMPLES) {
+        latencies.pop_front(); // Keep only the most recent samples
+    }
+}
+
+long PollScheduler::next_interval() {
+    // Stay at the minimum interval while we are in the hot window
+    if (clock::now() - last_activity < std::chrono::milliseconds(hot_window)) {
+        current = min_interval;
+    }
+
+    // Spread the polls so that many daemons do not hit the server in lockstep
+    std::uniform_real_distribution<double> spread(1.0 - jitter, 1.0 + jitter);
+    double interval = current * spread(rng);
+
+    return std::clamp(static_cast<long>(interval), min_interval, max_interval);
+}
+
+void PollScheduler::report(const std::string& name) {
+    const std::string prefix = "scheduler." + name + "."; // Metrics are kept per watcher
+
+    // Wakeups per hour since start
+    double hours = std::chrono::duration<double, std::ratio<3600>>(clock::now() - start).count();
+    if (hours > 0) {
+        metrics::counter(prefix + "wakeups_per_hour").set(static_cast<uint64_t>(wakeups / hours));
+    }
+    metrics::counter(prefix + "interval_ms").set(static_cast<uint64_t>(current));
+
+    if (latencies.empty()) {
+        return; // No tokens detected yet
+    }
+
+    // Percentiles of the detection latency
+    std::vector<long> sorted(latencies.begin(), latencies.end());
+    std::sort(sorted.begin(), sorted.end());
+    metrics::counter(prefix + "latency_p50_ms").set(sorted[sorted.size() * 50 / 100]);
+    metrics::counter(prefix + "latency_p99_ms").set(sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)]);
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "sender_filter.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+// Lowercase copy of a string
+static std::string to_lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+    return value;
+}
+
+// Removes surrounding whitespace and quotes
+static std::string trim(const std::string& value) {
+    size_t start = value.find_first_not_of(" \t\r\n\"");
+    size_t end = value.find_last_not_of(" \t\r\n\"");
+    return start == std::string::npos ? "" : value.substr(start, end - start + 1);
+}
+
+// IMAP quoted string (RFC 3501) of a search value, quotes and backslashes are escaped, line breaks cannot be sent
+static std::string quote(const std::string& value) {
+    std::string quoted = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            quoted.push_back('\\');
+        } else if (c == '\r' || c == '\n') {
+            c = ' ';
+        }
+        quoted.push_back(c);
+    }
+    return quoted + "\"";
+}
+
+// Builds a balanced tree of binary OR keys, keeping the nesting depth logarithmic
+static std::string combine(const std::vector<std::string>& keys, size_t begin, size_t end) {
+    if (end - begin == 1) {
+        return keys[begin];
+    }
+    size_t middle = begin + (end - begin) / 2;
+    return "OR " + combine(keys, begin, middle) + " " + combine(keys, middle, end);
+}
+
+// Constructor
+SenderFilter::SenderFilter(const std::vector<SenderRule>& rules) {
+    for (const SenderRule& rule : rules) {
+        std::string pattern = to_lower(trim(rule.pattern));
+        if (pattern.empty()) {
+            continue;
+        }
+
+        if (pattern.starts_with("*@")) {
+            std::string domain = pattern.substr(2);
+            domains[domain] = rule.profile; // Domain wildcard
+            criteria.push_back("FROM " + quote(domain)); // Substring search also covers subdomains
+        } else if (pattern.find('@') != std::string::npos) {
+            addresses[pattern] = rule.profile; // Exact address
+            criteria.push_back("FROM " + quote(pattern));
+        } else {
+            names.emplace_back(pattern, rule.profile); // Display name pattern
+            criteria.push_back("FROM " + quote(pattern));
+        }
+    }
+
+    if (criteria.empty()) {
+        Logger::logger().error("No sender rules configured."); // Log error if there is nothing to search for
+    }
+}
+
+std::string SenderFilter::search_criteria() const {
+    if (criteria.empty()) {
+        return "NOT ALL"; // Matches nothing
+    }
+    return combine(criteria, 0, criteria.size());
+}
+
+std::optional<SenderMatch> SenderFilter::match(const std::string& from) const {
+    // Strip the header name and unfold continuation lines
+    std::string value = from;
+    if (to_lower(value.substr(0, 5)) == "from:") {
+        value = value.substr(5);
+    }
+    std::replace(value.begin(), value.end(), '\r', ' ');
+    std::replace(value.begin(), value.end(), '\n', ' ');
+
+    // Split into display name and address
+    std::string name;
+    std::string address;
+    size_t open = value.find('<');
+    size_t close = value.find('>', open);
+    if (open != std::string::npos && close != std::string::npos) {
+        name = to_lower(trim(value.substr(0, open)));
+        address = to_lower(trim(value.substr(open + 1, close - open - 1)));
+    } else {
+        address = to_lower(trim(value));
+    }
+
+    // Exact addresses first
+    auto exact = addresses.find(address);
+    if (exact != addresses.end()) {
+        return SenderMatch{address, exact->second};
+    }
+
+    // Walk the domain from the most specific suffix to the least specific one
+    size_t at = address.find('@');
+    if (at != std::string::npos) {
+        std::string domain = address.substr(at + 1);
+        while (!domain.empty()) {
+            auto wildcard = domains.find(domain);
+            if (wildcard != domains.end()) {
+                return SenderMatch{address, wildcard->second};
+            }
+            size_t dot = domain.find('.');
+            if (dot == std::string::npos) {
+                break;
+            }
+            domain = domain.substr(dot + 1); // Try the parent domain
+        }
+    }
+
+    // Display names last, they are the weakest signal
+    for (const auto& [pattern, profile] : names) {
+        if (!name.empty() && name.find(pattern) != std::string::npos) {
+            return SenderMatch{address, profile};
+        }
+    }
+
+    return std::nullopt;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "token_cache.hpp"
+#include "metrics.hpp"
+
+#include <functional>
+
+// Constructor
+TokenCache::TokenCache(size_t capacity, std::chrono::seconds ttl) : capacity(capacity), ttl(ttl) {
+}
+
+std::optional<std::string> TokenCache::lookup(const std::string& key) {
+    static metrics::Counter& hits = metrics::counter("token_cache.hits");
+    static metrics::Counter& misses = metrics::counter("token_cache.misses");
+    std::lock_guard<std::mutex> lock(cache_mutex); // Lock the mutex for thread safety
+
+    auto it = index.find(key);
+    if (it == index.end()) {
+        misses.add();
+        return std::nullopt;
+    }
+
+    // Drop expired entries on access
+    if (clock::now() - it->second->inserted > ttl) {
+        entries.erase(it->second);
+        index.erase(it);
+        misses.add();
+        return std::nullopt;
+    }
+
+    entries.splice(entries.begin(), entries, it->second); // Mark as most recently used
+    hits.add();
+    return it->second->value;
+}
+
+void TokenCache::insert(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(cache_mutex); // Lock the mutex for thread safety
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+        entries.erase(it->second); // Refresh an existing entry
+        index.erase(it);
+    }
+
+    entries.push_front(Entry{key, value, clock::now()});
+    index[key] = entries.begin();
+
+    // Evict the least recently used entries
+    while (entries.size() > capacity) {
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+std::string TokenCache::message_key(const std::string& mailbox, const std::string& uidvalidity, const std::string& uid) {
+    return "msg:" + mailbox + ":" + uidvalidity + ":" + uid;
+}
+
+std::string TokenCache::token_key(const std::string& token, const std::string& sender) {
+    return "token:" + std::to_string(std::hash<std::string>{}(token + "\n" + sender));
+}
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "trace.hpp"
+#include "logger.hpp"
+
+#if TRACING
+
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <cstring>
+
+// Number of spans kept per thread, older spans are overwritten
+static constexpr size_t RING_SIZE = 4096;
+
+// A finished span
+struct Event {
+    const char* name; // Name of the span
+    char detail[48]; // Truncated detail, no allocation on the hot path
+    uint64_t start; // Start time in microseconds
+    uint64_t duration; // Duration in microseconds
+};
+
+// Ring buffer of one thread
+struct RingBuffer {
+    std::mutex mutex; // Only contended while dumping
+    std::vector<Event> events = std::vector<Event>(RING_SIZE);
+    size_t next = 0; // Next slot to write
+    size_t count = 0; // Number of valid events
+    int thread_id = 0; // Sequential id used as tid in the export
+};
+
+// All ring buffers, kept alive after their thread exits so they can still be dumped
+static std::vector<std::shared_ptr<RingBuffer>>& buffers() {
+    static std::vector<std::shared_ptr<RingBuffer>> instance;
+    return instance;
+}
+
+static std::mutex& buffers_mutex() {
+    static std::mutex instance; // Mutex for thread safety
+    return instance;
+}
+
+// Returns the ring buffer of the calling thread, registering it on first use
+static RingBuffer& local_buffer() {
+    thread_local std::shared_ptr<RingBuffer> buffer = [] {
+        auto created = std::make_shared<RingBuffer>();
+        std::lock_guard<std::mutex> lock(buffers_mutex());
+        created->thread_id = static_cast<int>(buffers().size()) + 1;
+        buffers().push_back(created);
+        return created;
+    }();
+    return *buffer;
+}
+
+// Microseconds since the start of the process
+static uint64_t now() {
+    static const auto origin = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+// Escapes a string for JSON output
+static std::string escape(const char* value) {
+    std::string result;
+    for (; *value; value++) {
+        unsigned char c = static_cast<unsigned char>(*value);
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += *value;
+        } else if (c < 0x20) {
+            result += ' '; // Control characters are not needed in a trace
+        } else {
+            result += *value;
+        }
+    }
+    return result;
+}
+
+trace::Span::Span(const char* name, std::string_view detail) : name(name), detail(detail), start(now()) {
+}
+
+trace::Span::~Span() {
+    uint64_t end = now();
+    RingBuffer& buffer = local_buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+
+    Event& event = buffer.events[buffer.next];
+    event.name = name;
+    size_t length = std::min(detail.size(), sizeof(event.detail) - 1);
+    std::memcpy(event.detail, detail.data(), length);
+    event.detail[length] = '\0';
+    event.start = start;
+    event.duration = end - start;
+
+    buffer.next = (buffer.next + 1) % RING_SIZE; // Overwrite the oldest span when full
+    buffer.count = std::min(buffer.count + 1, RING_SIZE);
+}
+
+bool trace::dump(const std::string& path) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out.is_open()) {
+        Logger::logger().error("Failed to open trace file: " + path);
+        return false;
+    }
+
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    size_t total = 0;
+
+    // Logging records spans itself, so the registry must be unlocked before logging
+    std::unique_lock<std::mutex> registry_lock(buffers_mutex());
+    for (const auto& buffer : buffers()) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+
+        // Oldest event first
+        size_t begin = (buffer->next + RING_SIZE - buffer->count) % RING_SIZE;
+        for (size_t i = 0; i < buffer->count; i++) {
+            const Event& event = buffer->events[(begin + i) % RING_SIZE];
+            out << (first ? "" : ",") << "\n{\"name\":\"" << escape(event.name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+                << ",\"ts\":" << event.start << ",\"dur\":" << event.duration;
+            if (event.detail[0] != '\0') {
+                out << ",\"args\":{\"detail\":\"" << escape(event.detail) << "\"}";
+            }
+            out << "}";
+            first = false;
+        }
+        total += buffer->count;
+    }
+    out << "\n]}\n";
+    registry_lock.unlock();
+
+    Logger::logger().info("Wrote " + std::to_string(total) + " trace spans to " + path + ".");
+    return true;
+}
+
+#else
+
+bool trace::dump(const std::string&) {
+    Logger::logger().warning("Tracing is disabled, set TRACING in defines.h to record spans.");
+    return false;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include "transcript.hpp"
+
+#include <stdexcept>
+
+// First line of every transcript
+static const std::string MAGIC = "TOKENDAEMON-TRANSCRIPT 1";
+
+// ===================================
+// TranscriptWriter
+// ===================================
+TranscriptWriter::TranscriptWriter(const std::string& path) : out(path, std::ios::binary | std::ios::trunc), start(std::chrono::steady_clock::now()) {
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed to open transcript file: " + path);
+    }
+    out << MAGIC << "\n";
+}
+
+void TranscriptWriter::write(TranscriptRecord type, const char* data, size_t length) {
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    out << static_cast<char>(type) << " " << time << " " << length << "\n";
+    out.write(data, length);
+    out << "\n";
+
+    if (type == RECORD_END) {
+        out.flush(); // Keep complete responses on disk if the daemon is killed
+    }
+}
+
+void TranscriptWriter::write(TranscriptRecord type, const std::string& data) {
+    write(type, data.data(), data.size());
+}
+
+// ===================================
+// TranscriptReader
+// ===================================
+TranscriptReader::TranscriptReader(const std::string& path) : in(path, std::ios::binary) {
+    if (!in.is_open()) {
+        throw std::runtime_error("Failed to open transcript file: " + path);
+    }
+
+    std::string magic;
+    if (!std::getline(in, magic) || magic != MAGIC) {
+        throw std::runtime_error("Not a session transcript: " + path);
+    }
+}
+
+bool TranscriptReader::next(TranscriptRecord& type, uint64_t& time, std::string& data) {
+    char record_type;
+    size_t length;
+    if (!(in >> record_type >> time >> length)) {
+        return false; // End of the transcript
+    }
+    in.get(); // Skip the newline after the record header
+
+    data.resize(length);
+    in.read(data.data(), length);
+    in.get(); // Skip the newline after the bytes
+    if (!in) {
+        throw std::runtime_error("Truncated session transcript.");
+    }
+
+    type = static_cast<TranscriptRecord>(record_type);
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "uid_set.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <charconv>
+
+namespace {
+    // Reads a nonzero UID at pos and moves pos behind it
+    uint32_t parse_uid(std::string_view text, size_t& pos) {
+        uint32_t uid = 0;
+        auto [end, error] = std::from_chars(text.data() + pos, text.data() + text.size(), uid);
+        if (error != std::errc() || uid == 0) {
+            throw std::invalid_argument("Invalid UID set: " + std::string(text));
+        }
+        pos = end - text.data();
+        return uid;
+    }
+}
+
+UidSet::UidSet(std::initializer_list<uint32_t> uids) {
+    for (uint32_t uid : uids) {
+        insert(uid);
+    }
+}
+
+UidSet UidSet::parse(std::string_view text) {
+    UidSet set;
+    size_t pos = text.find_first_not_of(' ');
+    while (pos != std::string_view::npos && pos < text.size()) {
+        uint32_t first = parse_uid(text, pos);
+        uint32_t last = first;
+        if (pos < text.size() && text[pos] == ':') {
+            pos++;
+            last = parse_uid(text, pos);
+        }
+        set.insert(std::min(first, last), std::max(first, last)); // "7:3" is the same as "3:7"
+
+        if (pos < text.size() && text[pos] != ',' && text[pos] != ' ') {
+            throw std::invalid_argument("Invalid UID set: " + std::string(text));
+        }
+        pos = text.find_first_not_of(", ", pos);
+    }
+    return set;
+}
+
+void UidSet::insert(uint32_t uid) {
+    insert(uid, uid);
+}
+
+void UidSet::insert(uint32_t first, uint32_t last) {
+    // Servers mostly return ascending UIDs, so appending is the common case
+    if (spans.empty() || static_cast<uint64_t>(spans.back().second) + 1 < first) {
+        spans.emplace_back(first, last);
+        return;
+    }
+
+    // First range that overlaps or touches [first, last]
+    auto it = std::lower_bound(spans.begin(), spans.end(), first, [](const Range& range, uint32_t uid) {
+        return static_cast<uint64_t>(range.second) + 1 < uid;
+    });
+    auto merge_end = it;
+    while (merge_end != spans.end() && merge_end->first <= static_cast<uint64_t>(last) + 1) {
+        first = std::min(first, merge_end->first);
+        last = std::max(last, merge_end->second);
+        ++merge_end;
+    }
+    if (it == merge_end) {
+        spans.insert(it, Range(first, last)); // Falls into a gap
+    } else {
+        *it = Range(first, last);
+        spans.erase(it + 1, merge_end);
+    }
+}
+
+void UidSet::insert(const UidSet& other) {
+    for (const Range& range : other.spans) {
+        insert(range.first, range.second);
+    }
+}
+
+void UidSet::clear() {
+    spans.clear();
+}
+
+bool UidSet::contains(uint32_t uid) const {
+    auto it = std::lower_bound(spans.begin(), spans.end(), uid, [](const Range& range, uint32_t value) {
+        return range.second < value;
+    });
+    return it != spans.end() && it->first <= uid;
+}
+
+bool UidSet::empty() const {
+    return spans.empty();
+}
+
+uint64_t UidSet::size() const {
+    uint64_t count = 0;
+    for (const Range& range : spans) {
+        count += static_cast<uint64_t>(range.second) - range.first + 1;
+    }
+    return count;
+}
+
+std::optional<uint32_t> UidSet::min() const {
+    return spans.empty() ? std::nullopt : std::optional<uint32_t>(spans.front().first);
+}
+
+std::optional<uint32_t> UidSet::max() const {
+    return spans.empty() ? std::nullopt : std::optional<uint32_t>(spans.back().second);
+}
+
+const std::vector<UidSet::Range>& UidSet::ranges() const {
+    return spans;
+}
+
+std::string UidSet::to_string() const {
+    std::string text;
+    for (const Range& range : spans) {
+        if (!text.empty()) {
+            text += ',';
+        }
+        text += std::to_string(range.first);
+        if (range.second != range.first) {
+            text += ':' + std::to_string(range.second);
+        }
+    }
+    return text;
+}
+
+UidSet::const_iterator UidSet::begin() const {
+    return const_iterator(&spans, 0);
+}
+
+UidSet::const_iterator UidSet::end() const {
+    return const_iterator(&spans, spans.size());
+}
\ No newline at end of file
@@ -1,16 +1,28 @@
 #include "logger.hpp"
 #include "utils.hpp"
+#include "trace.hpp"
 
 #include <string>
 #include <vector>
-#include <sstream>
-#include <optional>
 #include <stdexcept>
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <cstring>
 #include <openssl/bio.h>
 #include <openssl/evp.h>
 
+// SSE2 is part of every x86-64 target, other targets use the scalar loops
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define UTILS_SSE2 1
+    #include <emmintrin.h>
+#else
+    #define UTILS_SSE2 0
+#endif
+
 
 std::string base64::decode(const std::string &encoded_string) {
+    trace::Span span("base64::decode");
     BIO *bio, *b64;
     std::vector<char> buffer(encoded_string.size());
 
@@ -33,25 +45,258 @@ std::string base64::decode(const std::string &encoded_string) {
 }
 
 
-std::string base64::extract_base64_from_email(const std::string &input){
-    // Assuming the input is the email body containing the base64 string
-    std::istringstream stream(input);
-    std::string line;
-    std::string res;
-    std::optional<std::string> temp = std::nullopt;
+namespace {
+    // Value of a hex digit, -1 if the character is none
+    int hex_value(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10; // Not allowed by RFC 2045, but seen in the wild
+        return -1;
+    }
+
+    // Length of the UTF-8 sequence started by a lead byte, 0 for a continuation or invalid byte
+    size_t sequence_length(unsigned char c) {
+        if (c < 0x80) return 1;
+        if ((c & 0xE0) == 0xC0) return 2;
+        if ((c & 0xF0) == 0xE0) return 3;
+        if ((c & 0xF8) == 0xF0) return 4;
+        return 0;
+    }
 
-    // Copy everything except the first and last line of the email body
-    while(std::getline(stream, line)){
-        if(!temp.has_value()){
-            // Skip the first line
-            std::getline(stream, line);
-            temp = line; // Store the first line for later use
+    // Number of leading ASCII bytes, checked 16 at a time where SSE2 is available
+    size_t ascii_prefix(const unsigned char* data, size_t size) {
+        size_t i = 0;
+    #if UTILS_SSE2
+        for (; size - i >= 16; i += 16) {
+            int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+            if (mask != 0) {
+                return i + std::countr_zero(static_cast<unsigned>(mask));
+            }
         }
-        else {
-            res += temp.value() + "\n"; // Append the previous line to the result
-            temp = line;
+    #endif
+        while (i < size && data[i] < 0x80) {
+            i++;
         }
+        return i;
     }
 
-    return res; // Return the result string
+    // Code points of 0x80-0xFF in single-byte charsets, where they differ from ISO-8859-1
+    const std::array<uint16_t, 32> WINDOWS_1252 = {
+        0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+        0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+    };
+
+    uint32_t iso_8859_15(unsigned char c) {
+        switch (c) {
+            case 0xA4: return 0x20AC;
+            case 0xA6: return 0x0160;
+            case 0xA8: return 0x0161;
+            case 0xB4: return 0x017D;
+            case 0xB8: return 0x017E;
+            case 0xBC: return 0x0152;
+            case 0xBD: return 0x0153;
+            case 0xBE: return 0x0178;
+            default: return c;
+        }
+    }
+}
+
+
+std::string quoted_printable::decode(const std::string &input) {
+    trace::Span span("quoted_printable::decode");
+    std::string output;
+
+    // The output is never longer than the input, so it is written in place without bounds checks
+    output.resize_and_overwrite(input.size(), [&input](char* out, size_t) {
+        const char* start = out;
+        const char* in = input.data();
+        const char* end = in + input.size();
+
+        while (in < end) {
+            // Copy up to the next '='
+        #if UTILS_SSE2
+            const __m128i equals = _mm_set1_epi8('=');
+            while (end - in >= 16) {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), block); // out is never further than in, so 16 bytes fit
+                int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, equals));
+                if (mask != 0) {
+                    int skip = std::countr_zero(static_cast<unsigned>(mask));
+                    in += skip;
+                    out += skip;
+                    break;
+                }
+                in += 16;
+                out += 16;
+            }
+        #endif
+            const char* escape = static_cast<const char*>(std::memchr(in, '=', end - in));
+            if (escape == nullptr) {
+                escape = end;
+            }
+            std::memcpy(out, in, escape - in);
+            out += escape - in;
+            in = escape;
+            if (in == end) {
+                break;
+            }
+
+            // Soft line break, transports may leave whitespace between '=' and the line break
+            const char* next = in + 1;
+            while (next < end && (*next == ' ' || *next == '\t')) {
+                next++;
+            }
+            if (next < end && (*next == '\r' || *next == '\n')) {
+                in = next + (*next == '\r' && next + 1 < end && next[1] == '\n' ? 2 : 1);
+                continue;
+            }
+            if (end - in < 3) {
+                break; // Escape cut off by a partial fetch
+            }
+
+            int high = hex_value(in[1]);
+            int low = hex_value(in[2]);
+            if (high < 0 || low < 0) {
+                *out++ = *in++; // Not an escape, keep the '=' as written
+                continue;
+            }
+            *out++ = static_cast<char>(high << 4 | low);
+            in += 3;
+        }
+        return static_cast<size_t>(out - start);
+    });
+    return output;
+}
+
+
+size_t utf8::valid_prefix(std::string_view input) {
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(input.data());
+    size_t size = input.size();
+    size_t i = 0;
+
+    while (i < size) {
+        i += ascii_prefix(data + i, size - i); // Skip ASCII in bulk
+        if (i == size) {
+            break;
+        }
+
+        size_t length = sequence_length(data[i]);
+        if (length == 0 || size - i < length) {
+            return i;
+        }
+        uint32_t codepoint = data[i] & (0x7F >> length);
+        for (size_t k = 1; k < length; k++) {
+            if ((data[i + k] & 0xC0) != 0x80) {
+                return i;
+            }
+            codepoint = codepoint << 6 | (data[i + k] & 0x3F);
+        }
+
+        // Reject overlong forms, surrogates and code points beyond Unicode
+        static constexpr uint32_t MIN_CODEPOINT[5] = {0, 0, 0x80, 0x800, 0x10000};
+        if (codepoint < MIN_CODEPOINT[length] || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+            return i;
+        }
+        i += length;
+    }
+    return size;
+}
+
+
+bool utf8::is_valid(std::string_view input) {
+    return valid_prefix(input) == input.size();
+}
+
+
+void utf8::append(std::string &output, uint32_t codepoint) {
+    if (codepoint < 0x80) {
+        output.push_back(static_cast<char>(codepoint));
+    } else if (codepoint < 0x800) {
+        output.push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+        output.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else if (codepoint < 0x10000) {
+        output.push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+        output.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else {
+        output.push_back(static_cast<char>(0xF0 | (codepoint >> 18)));
+        output.push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    }
+}
+
+size_t utf8::incomplete_tail(std::string_view input) {
+    // A lead byte within the last 3 bytes whose sequence needs more bytes than are left
+    for (size_t back = 1; back <= std::min<size_t>(3, input.size()); back++) {
+        unsigned char c = static_cast<unsigned char>(input[input.size() - back]);
+        if ((c & 0xC0) == 0x80) {
+            continue; // Continuation byte, keep looking for the lead byte
+        }
+        size_t length = sequence_length(c);
+        return length > back ? back : 0;
+    }
+    return 0;
+}
+
+
+std::string utf8::from_charset(const std::string &input, const std::string &charset) {
+    trace::Span span("utf8::from_charset", charset);
+
+    if (charset.empty() || charset == "utf-8" || charset == "utf8" || charset == "us-ascii") {
+        if (is_valid(input)) {
+            return input; // The common case, no conversion needed
+        }
+
+        // Replace invalid bytes, drop a sequence cut off at the end of a partial fetch
+        std::string output;
+        output.reserve(input.size() + 16);
+        std::string_view rest(input);
+        while (!rest.empty()) {
+            size_t valid = valid_prefix(rest);
+            output.append(rest.substr(0, valid));
+            rest.remove_prefix(valid);
+            if (rest.empty()) {
+                break;
+            }
+            size_t length = sequence_length(static_cast<unsigned char>(rest[0]));
+            bool continued = std::all_of(rest.begin() + 1, rest.end(), [](char c) { return (c & 0xC0) == 0x80; });
+            if (length > rest.size() && continued) {
+                break; // Truncated, the next range completes it
+            }
+            output.append("\xEF\xBF\xBD"); // U+FFFD replacement character
+            rest.remove_prefix(1);
+        }
+        return output;
+    }
+
+    bool windows_1252 = charset == "windows-1252" || charset == "cp1252";
+    bool latin_9 = charset == "iso-8859-15" || charset == "latin-9";
+    if (!windows_1252 && !latin_9 && charset != "iso-8859-1" && charset != "latin1" && charset != "latin-1") {
+        Logger::logger().debug("Unsupported charset " + charset + ", leaving the text unchanged.");
+        return input;
+    }
+
+    // Single-byte charsets: ASCII is copied in bulk, every other byte becomes up to 3 UTF-8 bytes
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(input.data());
+    std::string output;
+    output.reserve(input.size() + input.size() / 8);
+    size_t i = 0;
+    while (i < input.size()) {
+        size_t ascii = ascii_prefix(data + i, input.size() - i);
+        output.append(input, i, ascii);
+        i += ascii;
+        if (i == input.size()) {
+            break;
+        }
+        unsigned char c = data[i++];
+        uint32_t codepoint = c;
+        if (windows_1252 && c < 0xA0) {
+            codepoint = WINDOWS_1252[c - 0x80];
+        } else if (latin_9) {
+            codepoint = iso_8859_15(c);
+        }
+        append(output, codepoint);
+    }
+    return output;
 }
\ No newline at end of file
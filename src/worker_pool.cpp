@@ -0,0 +1,164 @@
+#include "worker_pool.hpp"
+#include "os.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <stdexcept>
+#include <string>
+
+// Longest sleep of an idle worker, bounds the delay of jobs added to a busy shard
+static constexpr long MAX_IDLE_WAIT = 1000;
+
+// Heap order, earliest due time on top
+template <typename T>
+static bool later(const T& a, const T& b) {
+    return a.due > b.due;
+}
+
+// Constructor, 0 threads means one per core
+WorkerPool::WorkerPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        shards.push_back(std::make_unique<Shard>());
+    }
+}
+
+void WorkerPool::add(std::unique_ptr<Job> job) {
+    push(*shards[next_shard], Entry{clock::now(), false, 0, std::move(job)}); // Due right away
+    next_shard = (next_shard + 1) % shards.size();
+}
+
+void WorkerPool::run() {
+    // Workers without jobs could only steal, and there is nothing to steal from them
+    size_t jobs = 0;
+    for (const auto& shard : shards) {
+        jobs += shard->jobs.size();
+    }
+    shards.resize(std::min(shards.size(), std::max<size_t>(jobs, 1)));
+    Logger::logger().info("Running " + std::to_string(jobs) + " watchers on " + std::to_string(shards.size()) + " worker threads.");
+    metrics::counter("pool.workers").set(shards.size());
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < shards.size(); i++) {
+        workers.emplace_back(&WorkerPool::work, this, i);
+    }
+    work(0); // The calling thread is the first worker
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// Loop of one worker
+void WorkerPool::work(size_t index) {
+    static metrics::Counter& steals = metrics::counter("pool.steals");
+    static metrics::Counter& lag = metrics::counter("pool.lag_max_ms");
+
+    while (!os::shutdown_requested()) {
+        // Own jobs first, then the most overdue job of the other shards
+        auto now = clock::now();
+        Entry entry;
+        bool found = take_due(*shards[index], now, entry);
+        if (!found && steal(index, now, entry)) {
+            found = true;
+            steals.add();
+        }
+
+        if (found) {
+            long late = std::chrono::duration_cast<std::chrono::milliseconds>(now - entry.due).count();
+            if (late > 0) {
+                lag.set_max(late); // Time a job waited for a free worker
+            }
+
+            long next = 1000; // Retry a failed step after a second
+            entry.wakes = os::wakes(); // Wakes until now are handled by this step
+            try {
+                next = entry.job->step(entry.woken);
+            } catch (const std::exception& e) {
+                Logger::logger().error("Watcher failed: " + std::string(e.what())); // Jobs handle their own errors, this is a last resort
+            }
+            entry.due = clock::now() + std::chrono::milliseconds(std::max(0L, next));
+            entry.woken = false;
+            push(*shards[index], std::move(entry)); // A stolen job stays with the worker that ran it
+            continue;
+        }
+
+        // Sleep until the earliest job of any shard is due, a wake makes all of them due.
+        // Every idle worker returns for the same wake, the count keeps the jobs that ran since then from being woken twice.
+        long wait = std::chrono::duration_cast<std::chrono::milliseconds>(earliest_due() - clock::now()).count();
+        if (os::wait(std::clamp(wait, 1L, MAX_IDLE_WAIT)) == os::WAIT_WAKE) {
+            wake_jobs(os::wakes());
+        }
+    }
+}
+
+// Pops the earliest job if it is due
+bool WorkerPool::take_due(Shard& shard, clock::time_point now, Entry& entry) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.jobs.empty() || shard.jobs.front().due > now) {
+        return false;
+    }
+    std::pop_heap(shard.jobs.begin(), shard.jobs.end(), later<Entry>);
+    entry = std::move(shard.jobs.back());
+    shard.jobs.pop_back();
+    return true;
+}
+
+// Pops the most overdue job of the other shards, retries if another worker took it first
+bool WorkerPool::steal(size_t index, clock::time_point now, Entry& entry) {
+    for (size_t attempt = 1; attempt < shards.size(); attempt++) {
+        Shard* victim = nullptr;
+        clock::time_point earliest = now;
+        for (size_t i = 1; i < shards.size(); i++) {
+            Shard& shard = *shards[(index + i) % shards.size()];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (!shard.jobs.empty() && shard.jobs.front().due <= earliest) {
+                victim = &shard;
+                earliest = shard.jobs.front().due;
+            }
+        }
+        if (victim == nullptr) {
+            return false; // Nothing due anywhere
+        }
+        if (take_due(*victim, now, entry)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::push(Shard& shard, Entry entry) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.jobs.push_back(std::move(entry));
+    std::push_heap(shard.jobs.begin(), shard.jobs.end(), later<Entry>);
+}
+
+// Earliest due time of all shards
+WorkerPool::clock::time_point WorkerPool::earliest_due() {
+    clock::time_point earliest = clock::time_point::max();
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        if (!shard->jobs.empty()) {
+            earliest = std::min(earliest, shard->jobs.front().due);
+        }
+    }
+    return earliest;
+}
+
+// Makes every waiting job due now that has not started a step since the wake, jobs that are running just polled anyway
+void WorkerPool::wake_jobs(uint64_t wakes) {
+    auto now = clock::now();
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (Entry& entry : shard->jobs) {
+            if (entry.wakes < wakes) {
+                entry.due = std::min(entry.due, now);
+                entry.woken = true;
+            }
+        }
+        std::make_heap(shard->jobs.begin(), shard->jobs.end(), later<Entry>);
+    }
+}
\ No newline at end of file